@@ -9,11 +9,16 @@
  ******************************************************************************/
  // Modified by DS to clear texture buffer activation before drawing the second object on August 5, 2024
 
+#include <chrono>
+#include <cmath>
+#include <functional>
 #include <vector>
+#include <set>
 #include <string>
 #include <memory>
 #include <stdexcept>
 #include <stdio.h>
+#include <stdlib.h>
 #if __GNUG__
 #   include <tr1/memory>
 #endif
@@ -28,7 +33,29 @@
 #endif
 
 #include "ppm.h"
+#include "ppmcache.h"
 #include "glsupport.h"
+#include "atlas.h"
+#include "farm.h"
+#include "filewatch.h"
+#include "geometryarena.h"
+#include "hash.h"
+#include "mipmap.h"
+#include "meshopt.h"
+#include "obj.h"
+#include "pixelconvert.h"
+#include "rendercache.h"
+#include "samplers.h"
+#include "spritebatch.h"
+#include "streambuffer.h"
+#include "texcompress.h"
+#include "textureunits.h"
+#include "tilecache.h"
+#include "tilepool.h"
+#include "uploader.h"
+#include "uploadring.h"
+#include "vertexformat.h"
+#include "vertexpack.h"
 
  // added by ds to fix compile error C4996
 #pragma warning(disable : 4996)
@@ -74,18 +101,24 @@ static int g_xOffset           = 0.0;
 /** Like xOffset, but in the y direction. */
 static int g_yOffset           = 0.0;
 
+/** Command line, kept so that render farm workers can initialize GLUT after fork() */
+static int g_argc;
+static char **g_argv;
+
 /** Global shader states */
 struct SquareShaderState {
   GlProgram program;
 
   /** Handles to uniform variables */
   GLint h_uVertexScale;
+  GLint h_uPositionDecode;
   GLint h_uTex0, h_uTex1;
+  GLint h_uTexRect0, h_uTexRect1;
+  GLint h_uTexArray, h_uLayer0, h_uLayer1;
   GLint h_uXCoefficient, h_uYCoefficient;
 
-  /** Handles to vertex attributes */
-  GLint h_aPosition;
-  GLint h_aTexCoord;
+  /** Hash of the shader sources */
+  uint64_t sourceHash;
 };
 
 struct TriangleShaderState {
@@ -93,136 +126,829 @@ struct TriangleShaderState {
 
   /** Handles to uniform variables */
   GLint h_uTex2;
+  GLint h_uTexRect2;
+  GLint h_uFlipbook, h_uTime, h_uFrameRate, h_uNumFrames;
   GLint h_uXCoefficient, h_uYCoefficient;
   GLint h_uXOffset, h_uYOffset;
+  GLint h_uPositionDecode;
 
-  /** Handles to vertex attributes */
-  GLint h_aPosition;
-  GLint h_aTexCoord;
-  GLint h_aColor;
+  /** Hash of the shader sources */
+  uint64_t sourceHash;
+};
+
+/** Programs drawing many copies of the square or the triangle at once */
+struct InstancedShaderState {
+  GlProgram program;
+
+  /** Handles to uniform variables */
+  GLint h_uTexArray;
+  GLint h_uTime, h_uFrameRate, h_uNumFrames;
+  GLint h_uXCoefficient, h_uYCoefficient;
+  GLint h_uXOffset, h_uYOffset;
+  GLint h_uPositionDecode;
+
+  /** Hash of the shader sources */
+  uint64_t sourceHash;
 };
 
 static shared_ptr<SquareShaderState> g_squareShaderState;
+static shared_ptr<SquareShaderState> g_squareArrayShaderState;
 static shared_ptr<TriangleShaderState> g_triangleShaderState;
+static shared_ptr<TriangleShaderState> g_triangleFlipbookShaderState;
+static shared_ptr<InstancedShaderState> g_squareInstancedShaderState;
+static shared_ptr<InstancedShaderState> g_triangleInstancedShaderState;
+
+/** Program drawing the sprite layer */
+struct SpriteShaderState {
+  GlProgram program;
+
+  /** Handles to uniform variables */
+  GLint h_uTex;
+  GLint h_uViewportSize;
+
+  /** Hash of the shader sources */
+  uint64_t sourceHash;
+};
+
+static shared_ptr<SpriteShaderState> g_spriteShaderState;
+
+/** Program drawing the shapes of the shape arena */
+struct ArenaShaderState {
+  GlProgram program;
+
+  /** Handles to uniform variables */
+  GLint h_uViewportSize;
+
+  /** Hash of the shader sources */
+  uint64_t sourceHash;
+};
+
+static shared_ptr<ArenaShaderState> g_arenaShaderState;
+
+/**
+ * Vertex attribute locations, bound in every program before it is linked so
+ * that the attribute setup of a geometry suits all programs drawing it
+ */
+static const GLuint g_positionAttrib = 0;
+static const GLuint g_texCoordAttrib = 1;
+static const GLuint g_colorAttrib    = 2;
+static const GLuint g_instanceTransformAttrib = 3;
+static const GLuint g_instanceTintAttrib = 4;
 
 /** Global texture instance */
 static shared_ptr<GlTexture> g_tex0, g_tex1, g_tex2;
+static const char * const g_texFiles[3] = { "smiley.ppm", "reachup.ppm", "shield.ppm" };
+
+/** Hashes of the contents of the three texture images */
+static uint64_t g_textureHashes[3];
+
+/**
+ * The same three images packed into a single atlas texture. When g_useAtlas
+ * is set, the shaders sample each image from its region of the atlas instead
+ * of from its own texture, so a single texture stays bound for the whole frame.
+ */
+static shared_ptr<TextureAtlas> g_atlas;
+static shared_ptr<GlTexture> g_atlasTex;
+static int g_atlasImage0, g_atlasImage1, g_atlasImage2;
+static bool g_atlasFits        = false;
+static bool g_useAtlas         = false;
+static const int g_atlasPageSize = 2048;
+
+/**
+ * smiley.ppm and reachup.ppm as the two layers of one array texture. When
+ * g_useTextureArray is set, the square samples both layers through a single
+ * sampler2DArray instead of two textures.
+ */
+static shared_ptr<GlTexture> g_texArray;
+static bool g_useTextureArray  = false;
+
+/**
+ * The shield animated as a flipbook: the frames of a numbered image sequence
+ * as the layers of one array texture. The shader picks the layer from the
+ * time, so animating costs one uniform per draw rather than a bind or an
+ * upload per frame. Without a sequence, shield.ppm is the only frame.
+ */
+static shared_ptr<GlTexture> g_flipbook;
+static vector<string> g_flipbookFiles;
+static vector<const char*> g_flipbookFileNames;
+static bool g_useFlipbook      = false;
+static const char g_flipbookPattern[] = "shield-%02d.ppm";
+static const float g_flipbookFrameRate = 12;
+static float g_flipbookTime    = 0; /** seconds */
+
+/**
+ * Whether the mip chains of the textures are block compressed on the CPU
+ * (BC7 when the context has BPTC, otherwise BC1 when it has S3TC). The
+ * compressed chains are cached on disk, keyed by the image contents.
+ */
+static const bool g_compressTextures = true;
+static const char g_textureCacheDir[] = "texcache";
+
+/**
+ * Whether uncompressed textures are expanded to 4-byte BGRA texels before
+ * they are uploaded, so that the driver can take the rows as they are rather
+ * than repacking 3-byte RGB into its internal layout
+ */
+static const bool g_expandToBgra = true;
+
+/**
+ * Whether geometry is stored in compact vertex formats: positions as shorts
+ * normalized to their bounding box, texture coordinates as half floats and
+ * colors as bytes. Indices are 16 bits whenever the vertex count allows.
+ */
+static const bool g_compactVertices = true;
+
+/** Staging ring that texture uploads stream through, when the context supports it */
+static shared_ptr<UploadRing> g_uploadRing;
+static const size_t g_uploadRingBytes = 8 << 20;
+
+/**
+ * Ring that per-frame vertex data is written into, a region per frame, when
+ * drawing in the window
+ */
+static shared_ptr<StreamBuffer> g_streamBuffer;
+static const size_t g_streamBufferBytes = 4 << 20;
+
+/**
+ * Thread with a shared GL context that textures are loaded on, when the
+ * platform allows it. Each texture is usable once the ticket of the job that
+ * filled it has been acquired; a ticket of -1 means the texture is ready.
+ */
+static shared_ptr<TextureUploader> g_uploader;
+static int g_texTickets[3]     = { -1, -1, -1 };
+static int g_atlasTicket       = -1;
+static int g_texArrayTicket    = -1;
+static int g_flipbookTicket    = -1;
+static int g_uploadStateTicket = -1;
+
+/**
+ * Texture and shader files are watched while the program runs, and whatever
+ * was loaded from a file is loaded again when it is saved. A texture whose
+ * image keeps its size is updated in place, so it stays drawn while the new
+ * image is uploaded under g_reloadTickets; one whose size changed is marked
+ * in g_texResized and replaced by a new texture.
+ */
+static shared_ptr<FileWatcher> g_fileWatcher;
+static set<string> g_pendingReloads;
+static int g_reloadTickets[3]  = { -1, -1, -1 };
+static bool g_texResized[3];
+static const int g_reloadPollMs = 10;
+
+/**
+ * How the textures are sampled. With sampler objects, each state maps to one
+ * shared sampler bound next to the texture; otherwise it is set on the
+ * texture itself when it is loaded. The square's images get minified as it
+ * is scaled down, so they are filtered smoothly unless g_smoothFiltering is
+ * turned off; the shield keeps its blocky look.
+ */
+static shared_ptr<SamplerRegistry> g_samplers;
+static const SamplerState g_trilinearSampler = { GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE };
+static const SamplerState g_blockySampler = { GL_NEAREST_MIPMAP_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE };
+static const SamplerState g_unfilteredSampler = { GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE };
+static bool g_smoothFiltering  = true;
+
+/** Texture units of the window's context, and what is bound to them */
+static shared_ptr<TextureUnits> g_textureUnits;
+
+/** Number of glBindTexture calls made in the current and in the last frame */
+static int g_textureBinds      = 0;
+static int g_lastTextureBinds  = -1;
+
+/** Number of draw calls made in the current and in the last frame */
+static int g_draws             = 0;
+static int g_lastDraws         = -1;
+
+/**
+ * Vertices of the square and of the triangle. Attributes are interleaved in
+ * one buffer, so fetching a vertex reads one stream rather than one per
+ * attribute; the formats describing them are generated from the structs.
+ */
+struct VertexPT {
+  GLfloat pos[2];
+  GLfloat tex[2];
+};
+
+struct VertexPTC {
+  GLfloat pos[2];
+  GLfloat tex[2];
+  GLfloat color[3];
+};
+
+static const VertexAttribute g_vertexPTAttributes[] = {
+  VERTEX_ATTRIBUTE(VertexPT, pos, g_positionAttrib, GL_FALSE),
+  VERTEX_ATTRIBUTE(VertexPT, tex, g_texCoordAttrib, GL_FALSE),
+};
+static const VertexFormat g_vertexPTFormat = vertexFormat<VertexPT>(g_vertexPTAttributes);
+
+static const VertexAttribute g_vertexPTCAttributes[] = {
+  VERTEX_ATTRIBUTE(VertexPTC, pos, g_positionAttrib, GL_FALSE),
+  VERTEX_ATTRIBUTE(VertexPTC, tex, g_texCoordAttrib, GL_FALSE),
+  VERTEX_ATTRIBUTE(VertexPTC, color, g_colorAttrib, GL_FALSE),
+};
+static const VertexFormat g_vertexPTCFormat = vertexFormat<VertexPTC>(g_vertexPTCAttributes);
+
+/**
+ * The same vertices in compact form, as packVertices() makes them. Colors get
+ * a fourth component so that vertices stay 4-byte aligned.
+ */
+struct CompactVertexPT {
+  GLshort pos[2];
+  Half tex[2];
+};
+
+struct CompactVertexPTC {
+  GLshort pos[2];
+  Half tex[2];
+  GLubyte color[4];
+};
+
+static const VertexAttribute g_compactVertexPTAttributes[] = {
+  VERTEX_ATTRIBUTE(CompactVertexPT, pos, g_positionAttrib, GL_TRUE),
+  VERTEX_ATTRIBUTE(CompactVertexPT, tex, g_texCoordAttrib, GL_FALSE),
+};
+static const VertexFormat g_compactVertexPTFormat = vertexFormat<CompactVertexPT>(g_compactVertexPTAttributes);
+
+static const VertexAttribute g_compactVertexPTCAttributes[] = {
+  VERTEX_ATTRIBUTE(CompactVertexPTC, pos, g_positionAttrib, GL_TRUE),
+  VERTEX_ATTRIBUTE(CompactVertexPTC, tex, g_texCoordAttrib, GL_FALSE),
+  VERTEX_ATTRIBUTE(CompactVertexPTC, color, g_colorAttrib, GL_TRUE),
+};
+static const VertexFormat g_compactVertexPTCFormat = vertexFormat<CompactVertexPTC>(g_compactVertexPTCAttributes);
 
 /** Global geometries to draw a triangle with indecies */ 
 struct GeometryPX {
-  GlBufferObject posVbo, texVbo, colorVbo, indexVbo;
+  GlBufferObject vbo, indexVbo;
+  const VertexFormat *format;
+  GLsizei numIndices;
+  GLenum indexType;
+
+  /**
+   * Turns the stored positions back into object coordinates: offset in xy,
+   * scale in zw. Identity unless the positions are normalized shorts.
+   */
+  GLfloat positionDecode[4];
+
+  /**
+   * Records the attribute setup once, so that a draw only binds it. Empty
+   * when the context has no vertex array objects; the attributes are then set
+   * up on every draw.
+   */
+  shared_ptr<GlVertexArray> vao;
+
+  /** Hash of the vertex and index data */
+  uint64_t contentHash;
 };
 
 static shared_ptr<GeometryPX> g_square;
 static shared_ptr<GeometryPX> g_triangle;
 
+/**
+ * OBJ file drawn in place of the triangle, from the --obj option. Its
+ * vertices come in the order of the triangle's, so they fit the same
+ * programs and compact format.
+ */
+static const char *g_objFilename = NULL;
+
+/**
+ * Reorder the loaded mesh's triangles for the post-transform vertex cache,
+ * and its vertices for fetch locality. Overlapping triangles are drawn
+ * without a depth test, so this can change which of them ends up on top.
+ */
+static const bool g_optimizeMeshes = true;
+
+static const VertexAttribute g_objVertexAttributes[] = {
+  VERTEX_ATTRIBUTE(ObjVertex, pos, g_positionAttrib, GL_FALSE),
+  VERTEX_ATTRIBUTE(ObjVertex, tex, g_texCoordAttrib, GL_FALSE),
+  VERTEX_ATTRIBUTE(ObjVertex, color, g_colorAttrib, GL_FALSE),
+};
+static const VertexFormat g_objVertexFormat = vertexFormat<ObjVertex>(g_objVertexAttributes);
+
+/**
+ * Instanced mode: the square and the triangle are each drawn g_numInstances
+ * times on a grid, with one glDrawElementsInstanced call apiece. What differs
+ * between the copies comes from per-instance attributes rather than from
+ * uniforms, so the CPU cost of a frame does not grow with their number.
+ * Needs GL 3.3.
+ */
+struct InstancePX {
+  GLfloat transform[4];  /** offset in xy, scale in z, texture layer (first flipbook frame) in w */
+  GLubyte tint[4];
+};
+
+static const VertexAttribute g_instancePXAttributes[] = {
+  VERTEX_ATTRIBUTE(InstancePX, transform, g_instanceTransformAttrib, GL_FALSE),
+  VERTEX_ATTRIBUTE(InstancePX, tint, g_instanceTintAttrib, GL_TRUE),
+};
+static const VertexFormat g_instancePXFormat = vertexFormat<InstancePX>(g_instancePXAttributes);
+
+/** Copies of a geometry, and the attribute setup drawing them */
+struct InstanceSet {
+  GlBufferObject vbo;
+  GlVertexArray vao;
+  GLsizei numInstances;
+};
+
+static shared_ptr<InstanceSet> g_squareInstances;
+static shared_ptr<InstanceSet> g_triangleInstances;
+static bool g_useInstancing    = false;
+static int g_numInstances      = 1000;
+static const int g_maxInstances = 100000;
+
+/**
+ * Sprite layer: g_numSprites independently moving quads, drawn over the scene
+ * in window coordinates. They are collected into a batch every frame and
+ * drawn with one call per texture when g_sortSprites is set, otherwise with
+ * one per change of texture.
+ */
+static shared_ptr<SpriteBatch> g_spriteBatch;
+static bool g_useSprites       = false;
+static bool g_sortSprites      = true;
+static const int g_numSprites  = 5000;
+static const int g_spriteBatchCapacity = 16384;
+
+/**
+ * Shape arena: g_numArenaDraws spinning shapes in window coordinates, each
+ * one of g_numArenaMeshes different polygons and stars. The meshes share the
+ * buffers of one GeometryArena, so all the shapes are drawn with a single
+ * glMultiDrawElementsIndirect; each draw reads where it goes and its color
+ * from a shader storage buffer, indexed by gl_DrawID. Needs GL 4.3 and
+ * ARB_shader_draw_parameters.
+ */
+struct ArenaVertex {
+  GLfloat pos[2];
+};
+
+static const VertexAttribute g_arenaVertexAttributes[] = {
+  VERTEX_ATTRIBUTE(ArenaVertex, pos, g_positionAttrib, GL_FALSE),
+};
+static const VertexFormat g_arenaVertexFormat = vertexFormat<ArenaVertex>(g_arenaVertexAttributes);
+
+/** Per-draw data, laid out as the std430 array of the arena vertex shader */
+struct ArenaDraw {
+  GLfloat transform[4];  /** offset in xy, scale times the cosine and sine of the rotation in zw */
+  GLfloat color[4];
+};
+
+static shared_ptr<GeometryArena> g_arena;
+static bool g_useArena         = false;
+static const int g_numArenaMeshes = 1024;
+static const int g_numArenaDraws = 4096;
+static const int g_maxArenaPoints = 15;   /** points of the spikiest star */
+static const GLuint g_arenaDrawsBinding = 0;
+static size_t g_arenaDrawsAlignment;
+
+/** Frames timed since g_frameTimerStart, while drawing instances or sprites */
+static chrono::steady_clock::time_point g_frameTimerStart;
+static int g_framesTimed       = 0;
+
+/** Offscreen render target used by render farm workers */
+struct OffscreenTarget {
+  GlFramebuffer fbo;
+  GlRenderbuffer color, depth;
+};
+
+static shared_ptr<OffscreenTarget> g_offscreen;
+
+/**
+ * Render farm workers look up every frame in this cache, keyed by a hash of
+ * all inputs of the frame, before drawing it.
+ */
+static const char g_renderCacheDir[] = "rendercache";
+
+/**
+ * Part of every key. Bump it whenever a change to the code alters what the
+ * same inputs render to (filtering, pixel formats, vertex formats), so that
+ * frames cached by older builds are not served.
+ */
+static const uint32_t g_rendererVersion = 2;
+static const uint64_t g_renderCacheBytes = 256 << 20;
+static shared_ptr<RenderCache> g_renderCache;
+
 
 /* C A L L B A C K S **************************************************/
 
-static void drawSquare() {
-  /* Activate the glsl program */
-  glUseProgram(g_squareShaderState->program);
+/**
+ * Binds a texture and the sampler object for `sampler' to a unit of their own,
+ * and points a sampler uniform of the program in use at it
+ */
+static void bindTexture(GLuint program, GLint samplerHandle, GLenum target, GLuint texHandle,
+                        const SamplerState& sampler) {
+  const GLuint samplerObject = g_samplers ? g_samplers->get(sampler) : 0;
+  g_textureUnits->setSampler(program, samplerHandle, g_textureUnits->bind(target, texHandle, samplerObject));
+}
 
-  /* Bind textures */
-  // Activate the texture unit first before binding texture
-  GLuint texHandle0 = g_tex0->getHandle();
+static const SamplerState& squareSampler() {
+  return g_smoothFiltering ? g_trilinearSampler : g_blockySampler;
+}
 
-  glActiveTexture(GL_TEXTURE0 + texHandle0);
-  glBindTexture(GL_TEXTURE_2D, texHandle0);
+/**
+ * True once the texture filled by the uploader job `ticket' may be used.
+ * The first time, this makes the GL wait for the uploads of the job. A job
+ * that failed is reported and then counts as done: its texture is left
+ * incomplete, which samples as black, as this runs inside GLUT callbacks that
+ * must not throw.
+ */
+static bool uploadDone(int& ticket) {
+  if (ticket < 0)
+    return true;
+  try {
+    if (!g_uploader->acquire(ticket))
+      return false;
+  }
+  catch (const runtime_error& e) {
+    cerr << "ERROR: " << e.what() << endl;
+  }
+  ticket = -1;
+  return true;
+}
 
-  // Activate the texture unit second before binding texture
-  GLuint texHandle1 = g_tex1->getHandle();
+/**
+ * uploadDone() for the atlas. Whether its images fit on one page is only known
+ * once it is done; if they do not, g_useAtlas is turned off.
+ */
+static bool atlasDone() {
+  if (!uploadDone(g_atlasTicket))
+    return false;
+  if (!g_atlasFits)
+    g_useAtlas = false;
+  return true;
+}
 
-  glActiveTexture(GL_TEXTURE0 + texHandle1);
-  glBindTexture(GL_TEXTURE_2D, texHandle1);
+static bool squareTexturesReady() {
+  if (g_useTextureArray || g_useInstancing)
+    return uploadDone(g_texArrayTicket);
+  if (g_useAtlas && !atlasDone())
+    return false;
+  if (g_useAtlas)
+    return true;
+  return uploadDone(g_texTickets[0]) && uploadDone(g_texTickets[1]);
+}
 
-  /* Compute coefficients for maintaining aspect ratio */
-  float scaleCoefficient = min(g_width / g_initialWidth, g_height / g_initialHeight);
+static bool triangleTexturesReady() {
+  if (g_useFlipbook || g_useInstancing)
+    return uploadDone(g_flipbookTicket);
+  if (g_useAtlas && !atlasDone())
+    return false;
+  return g_useAtlas || uploadDone(g_texTickets[2]);
+}
 
-  /* Set glsl uniform variables */
-  safe_glUniform1i(g_squareShaderState->h_uTex0, texHandle0); /* texHandle0 is 0 as the new values to be used for the specified uniform variable.*/
-  safe_glUniform1i(g_squareShaderState->h_uTex1, texHandle1); /* texHandle1 is 1 as the new values to be used for the specified uniform variable.*/
-  safe_glUniform1f(g_squareShaderState->h_uVertexScale, g_objScale);
-  safe_glUniform1f(g_squareShaderState->h_uXCoefficient, g_initialWidth / g_width * scaleCoefficient);
-  safe_glUniform1f(g_squareShaderState->h_uYCoefficient, g_initialHeight / g_height * scaleCoefficient);
+/** Sets a vec4 uniform to the part of the atlas texture holding an image */
+static void setAtlasRegion(GLint handle, int image) {
+  const AtlasRegion& r = g_atlas->region(image);
+  safe_glUniform4f(handle, r.u0, r.v0, r.u1 - r.u0, r.v1 - r.v0);
+}
+
+/** Sets uniform `handle' to how the positions of `g' are decoded */
+static void setPositionDecode(GLint handle, const GeometryPX& g) {
+  const GLfloat *d = g.positionDecode;
+  safe_glUniform4f(handle, d[0], d[1], d[2], d[3]);
+}
+
+/** Makes `g' the geometry glDrawElements draws from */
+static void bindGeometry(const GeometryPX& g) {
+  if (g.vao)
+    glBindVertexArray(*g.vao);
+  else {
+    setVertexAttributes(*g.format, g.vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.indexVbo);
+  }
+}
 
-  /* Bind vertex buffers */
-  glBindBuffer(GL_ARRAY_BUFFER, g_square->posVbo);
-  safe_glVertexAttribPointer(g_squareShaderState->h_aPosition,
-                             2, GL_FLOAT, GL_FALSE, 0, 0);
+static void unbindGeometry(const GeometryPX& g) {
+  if (!g.vao)
+    disableVertexAttributes(*g.format);
+}
+
+static void drawSquare() {
+  SquareShaderState& ss = g_useTextureArray ? *g_squareArrayShaderState : *g_squareShaderState;
 
-  glBindBuffer(GL_ARRAY_BUFFER, g_square->texVbo);
-  safe_glVertexAttribPointer(g_squareShaderState->h_aTexCoord,
-                             2, GL_FLOAT, GL_FALSE, 0, 0);
+  /* Activate the glsl program */
+  glUseProgram(ss.program);
+
+  /* Bind textures. Textures keep their unit from frame to frame, so this
+   * normally neither binds anything nor sets the sampler uniforms again. */
+  g_textureUnits->beginDraw();
+  if (g_useTextureArray) {
+    // Both images are layers of one array texture: a single bind
+    bindTexture(ss.program, ss.h_uTexArray, GL_TEXTURE_2D_ARRAY, *g_texArray, g_unfilteredSampler);
+  }
+  else if (g_useAtlas) {
+    // Both images come from the atlas
+    bindTexture(ss.program, ss.h_uTex0, GL_TEXTURE_2D, *g_atlasTex, g_unfilteredSampler);
+    bindTexture(ss.program, ss.h_uTex1, GL_TEXTURE_2D, *g_atlasTex, g_unfilteredSampler);
+    setAtlasRegion(ss.h_uTexRect0, g_atlasImage0);
+    setAtlasRegion(ss.h_uTexRect1, g_atlasImage1);
+  }
+  else {
+    bindTexture(ss.program, ss.h_uTex0, GL_TEXTURE_2D, *g_tex0, squareSampler());
+    bindTexture(ss.program, ss.h_uTex1, GL_TEXTURE_2D, *g_tex1, squareSampler());
+    safe_glUniform4f(ss.h_uTexRect0, 0, 0, 1, 1);
+    safe_glUniform4f(ss.h_uTexRect1, 0, 0, 1, 1);
+  }
 
-  safe_glEnableVertexAttribArray(g_squareShaderState->h_aPosition);
-  safe_glEnableVertexAttribArray(g_squareShaderState->h_aTexCoord);
+  /* Compute coefficients for maintaining aspect ratio */
+  float scaleCoefficient = min(g_width / g_initialWidth, g_height / g_initialHeight);
 
-  // Bind the index buffer and draw elements
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_square->indexVbo);
-  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  /* Set glsl uniform variables */
+  safe_glUniform1f(ss.h_uVertexScale, g_objScale);
+  safe_glUniform1f(ss.h_uXCoefficient, g_initialWidth / g_width * scaleCoefficient);
+  safe_glUniform1f(ss.h_uYCoefficient, g_initialHeight / g_height * scaleCoefficient);
+  setPositionDecode(ss.h_uPositionDecode, *g_square);
 
-  safe_glDisableVertexAttribArray(g_squareShaderState->h_aPosition);
-  safe_glDisableVertexAttribArray(g_squareShaderState->h_aTexCoord);
+  bindGeometry(*g_square);
+  glDrawElements(GL_TRIANGLES, g_square->numIndices, g_square->indexType, 0);
+  ++g_draws;
+  unbindGeometry(*g_square);
 
   /* Check for errors */
   checkGlErrors();
 }
 
 static void drawTriangle() {
+  TriangleShaderState& ts = g_useFlipbook ? *g_triangleFlipbookShaderState : *g_triangleShaderState;
 
   /* Activate the glsl program */
-  glUseProgram(g_triangleShaderState->program);
+  glUseProgram(ts.program);
 
   /* Bind textures */
-  // Activate the texture unit first before binding texture
-  GLuint texHandle2 = g_tex2->getHandle();
-  glActiveTexture(GL_TEXTURE0 + texHandle2);
-  glBindTexture(GL_TEXTURE_2D, texHandle2);
+  g_textureUnits->beginDraw();
+  if (g_useFlipbook) {
+    // Every frame of the animation is in this one texture; the shader picks one
+    bindTexture(ts.program, ts.h_uFlipbook, GL_TEXTURE_2D_ARRAY, *g_flipbook, g_unfilteredSampler);
+    safe_glUniform1f(ts.h_uTime, g_flipbookTime);
+    safe_glUniform1i(ts.h_uNumFrames, g_flipbookFiles.size());
+  }
+  else if (g_useAtlas) {
+    bindTexture(ts.program, ts.h_uTex2, GL_TEXTURE_2D, *g_atlasTex, g_unfilteredSampler);
+    setAtlasRegion(ts.h_uTexRect2, g_atlasImage2);
+  }
+  else {
+    bindTexture(ts.program, ts.h_uTex2, GL_TEXTURE_2D, *g_tex2, g_blockySampler);
+    safe_glUniform4f(ts.h_uTexRect2, 0, 0, 1, 1);
+  }
 
   /* Compute coefficients for maintaining aspect ratio */
   float scaleCoefficient = min(g_width / g_initialWidth, g_height / g_initialHeight);
 
   /* Set glsl uniform variables */
-  safe_glUniform1i(g_triangleShaderState->h_uTex2, texHandle2); /* texHandle2 is 2 as the new values to be used for the specified uniform variable. */
-  safe_glUniform1f(g_triangleShaderState->h_uXCoefficient, g_initialWidth / g_width * scaleCoefficient);
-  safe_glUniform1f(g_triangleShaderState->h_uYCoefficient, g_initialHeight / g_height * scaleCoefficient);
+  safe_glUniform1f(ts.h_uXCoefficient, g_initialWidth / g_width * scaleCoefficient);
+  safe_glUniform1f(ts.h_uYCoefficient, g_initialHeight / g_height * scaleCoefficient);
 
   /* Uniform variables used to move the triangle around the screen */
-  safe_glUniform1f(g_triangleShaderState->h_uXOffset, g_xOffset * .05);
-  safe_glUniform1f(g_triangleShaderState->h_uYOffset, g_yOffset * .05);
+  safe_glUniform1f(ts.h_uXOffset, g_xOffset * .05);
+  safe_glUniform1f(ts.h_uYOffset, g_yOffset * .05);
+  setPositionDecode(ts.h_uPositionDecode, *g_triangle);
+
+  bindGeometry(*g_triangle);
+  glDrawElements(GL_TRIANGLES, g_triangle->numIndices, g_triangle->indexType, 0);
+  ++g_draws;
+  unbindGeometry(*g_triangle);
+
+  /* Check for errors */
+  checkGlErrors();
+}
+
+/**
+ * Fills `s' with `numInstances' copies of geometry `g', laid out on a square
+ * grid covering the window. Copy i shows texture layer i % numLayers.
+ */
+static void loadInstances(InstanceSet& s, const GeometryPX& g, int numInstances, int numLayers) {
+  const int columns = int(ceil(sqrt(double(numInstances))));
+  const float cell = 2.f / columns;
+
+  vector<InstancePX> instances(numInstances);
+  for (int i = 0; i < numInstances; ++i) {
+    InstancePX& p = instances[i];
+    p.transform[0] = -1 + cell * (i % columns + .5f);
+    p.transform[1] = -1 + cell * (i / columns + .5f);
+    p.transform[2] = cell * .9f;
+    p.transform[3] = float(i % numLayers);
+
+    /* a different light tint for each copy, from a hash of its index */
+    const uint32_t h = uint32_t(i) * 2654435761u;
+    p.tint[0] = GLubyte(128 + (h >> 25));
+    p.tint[1] = GLubyte(128 + ((h >> 18) & 127));
+    p.tint[2] = GLubyte(128 + ((h >> 11) & 127));
+    p.tint[3] = 255;
+  }
+
+  s.numInstances = numInstances;
+  s.vbo.data(numInstances * sizeof(InstancePX), &instances[0], GL_STATIC_DRAW);
+
+  glBindVertexArray(s.vao);
+  setVertexAttributes(*g.format, g.vbo);
+  setVertexAttributes(g_instancePXFormat, s.vbo, 1);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.indexVbo);
+  glBindVertexArray(0);
+  checkGlErrors();
+}
+
+static void initInstances() {
+  g_squareInstances.reset(new InstanceSet());
+  loadInstances(*g_squareInstances, *g_square, g_numInstances, 2);
+
+  g_triangleInstances.reset(new InstanceSet());
+  loadInstances(*g_triangleInstances, *g_triangle, g_numInstances, max(1, int(g_flipbookFiles.size())));
+}
+
+/** Sets the uniforms placing the copies in the window */
+static void setInstancedUniforms(const InstancedShaderState& s, const GeometryPX& g) {
+  const float scaleCoefficient = min(g_width / g_initialWidth, g_height / g_initialHeight);
+  safe_glUniform1f(s.h_uXCoefficient, g_initialWidth / g_width * scaleCoefficient);
+  safe_glUniform1f(s.h_uYCoefficient, g_initialHeight / g_height * scaleCoefficient);
+  setPositionDecode(s.h_uPositionDecode, g);
+}
+
+/** Draws the copies in `s' of geometry `g' with a single call */
+static void drawInstances(const InstanceSet& s, const GeometryPX& g) {
+  glBindVertexArray(s.vao);
+  glDrawElementsInstanced(GL_TRIANGLES, g.numIndices, g.indexType, 0, s.numInstances);
+  ++g_draws;
+  glBindVertexArray(0);
+}
+
+static void drawSquareInstances() {
+  InstancedShaderState& ss = *g_squareInstancedShaderState;
+  glUseProgram(ss.program);
+
+  g_textureUnits->beginDraw();
+  bindTexture(ss.program, ss.h_uTexArray, GL_TEXTURE_2D_ARRAY, *g_texArray, g_unfilteredSampler);
+  setInstancedUniforms(ss, *g_square);
+  drawInstances(*g_squareInstances, *g_square);
+
+  /* Check for errors */
+  checkGlErrors();
+}
 
-  /* Bind vertex buffers */
-  glBindBuffer(GL_ARRAY_BUFFER, g_triangle->posVbo);
+static void drawTriangleInstances() {
+  InstancedShaderState& ts = *g_triangleInstancedShaderState;
+  glUseProgram(ts.program);
 
-  safe_glVertexAttribPointer(g_triangleShaderState->h_aPosition,
-                             2, GL_FLOAT, GL_FALSE, 0, 0);
+  g_textureUnits->beginDraw();
+  bindTexture(ts.program, ts.h_uTexArray, GL_TEXTURE_2D_ARRAY, *g_flipbook, g_unfilteredSampler);
+  safe_glUniform1f(ts.h_uTime, g_flipbookTime);
+  safe_glUniform1i(ts.h_uNumFrames, g_flipbookFiles.size());
+  safe_glUniform1f(ts.h_uXOffset, g_xOffset * .05);
+  safe_glUniform1f(ts.h_uYOffset, g_yOffset * .05);
+  setInstancedUniforms(ts, *g_triangle);
+  drawInstances(*g_triangleInstances, *g_triangle);
 
-  glBindBuffer(GL_ARRAY_BUFFER, g_triangle->texVbo);
-  safe_glVertexAttribPointer(g_triangleShaderState->h_aTexCoord,
-                             2, GL_FLOAT, GL_FALSE, 0, 0);
+  /* Check for errors */
+  checkGlErrors();
+}
+
+/**
+ * Adds sprite i to the batch: one of the three images, circling its own point
+ * of the window while it spins, at time `t' seconds
+ */
+static void addSprite(int i, float t) {
+  /* fixed properties of the sprite, from a hash of its index */
+  const uint32_t h = uint32_t(i) * 2654435761u;
+  const float cx = (h & 1023) / 1023.f * g_width, cy = ((h >> 10) & 1023) / 1023.f * g_height;
+  const float phase = (h >> 20) / 4096.f * 6.2831853f;
+  const float size = 16 + (h >> 27);
+  const GLuint textures[3] = { *g_tex0, *g_tex1, *g_tex2 };
+
+  const float angle = phase + t * (i % 2 ? 1.f : -1.f);
+  const float x = cx + 40 * cos(angle), y = cy + 40 * sin(angle);
+  const float c = size * cos(2 * angle), s = size * sin(2 * angle);
+
+  /* spin about the center of the quad */
+  const GLfloat transform[6] = { c, s, -s, c, x - .5f * (c - s), y - .5f * (s + c) };
+  static const GLfloat uv[4] = { 0, 0, 1, 1 };
+  const GLubyte color[4] = { GLubyte(160 + (h >> 26)), GLubyte(160 + ((h >> 21) & 63)),
+                             GLubyte(160 + ((h >> 15) & 63)), 255 };
+  g_spriteBatch->add(textures[i % 3], transform, uv, color);
+}
+
+static void drawSprites() {
+  SpriteShaderState& ss = *g_spriteShaderState;
+  glUseProgram(ss.program);
+  safe_glUniform2f(ss.h_uViewportSize, g_width, g_height);
 
-  glBindBuffer(GL_ARRAY_BUFFER, g_triangle->colorVbo);
-  safe_glVertexAttribPointer(g_triangleShaderState->h_aColor,
-                             3, GL_FLOAT, GL_FALSE, 0, 0);
+  const float t = glutGet(GLUT_ELAPSED_TIME) / 1000.f;
+  for (int i = 0; i < g_numSprites; ++i)
+    addSprite(i, t);
 
-  safe_glEnableVertexAttribArray(g_triangleShaderState->h_aPosition);
-  safe_glEnableVertexAttribArray(g_triangleShaderState->h_aTexCoord);
-  safe_glEnableVertexAttribArray(g_triangleShaderState->h_aColor);
+  const GLuint sampler = g_samplers ? g_samplers->get(g_trilinearSampler) : 0;
+  g_draws += g_spriteBatch->flush(*g_textureUnits, ss.program, ss.h_uTex, sampler, g_sortSprites);
+
+  /* Check for errors */
+  checkGlErrors();
+}
+
+/**
+ * Whether the context can draw the shape arena. Its shaders are GLSL 4.30,
+ * for the shader storage block, so the extensions alone are not enough.
+ */
+static bool arenaSupported() {
+  return GLEW_VERSION_4_3 && GeometryArena::supported() && (GLEW_VERSION_4_6 || GLEW_ARB_shader_draw_parameters);
+}
 
-  // Bind the index buffer and draw elements
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_triangle->indexVbo);
-  glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, 0);
+/**
+ * Fills the shape arena with its meshes: mesh k is a star with 3 + k % 13
+ * points, fanned out from its center, whose inner radius grows with k up to
+ * that of a polygon with twice as many sides
+ */
+static void initArena() {
+  const int numPointCounts = g_maxArenaPoints - 2;
+  const int maxVertices = 1 + 2 * g_maxArenaPoints;
+  g_arena.reset(new GeometryArena(g_arenaVertexFormat, g_numArenaMeshes * maxVertices,
+                                  g_numArenaMeshes * 3 * (maxVertices - 1), g_streamBuffer.get()));
+
+  vector<ArenaVertex> vertices;
+  vector<GLushort> indices;
+  for (int k = 0; k < g_numArenaMeshes; ++k) {
+    const int points = 3 + k % numPointCounts;
+    const float inner = .3f + .7f * (k / numPointCounts) / ((g_numArenaMeshes - 1) / numPointCounts);
+    const int rim = 2 * points;
+
+    vertices.assign(1, ArenaVertex());
+    vertices[0].pos[0] = vertices[0].pos[1] = 0;
+    indices.clear();
+    for (int i = 0; i < rim; ++i) {
+      const float angle = i * 6.2831853f / rim, r = i % 2 ? inner : 1;
+      ArenaVertex v = { { r * cos(angle), r * sin(angle) } };
+      vertices.push_back(v);
+
+      const GLushort fan[3] = { 0, GLushort(1 + i), GLushort(1 + (i + 1) % rim) };
+      indices.insert(indices.end(), fan, fan + 3);
+    }
+    g_arena->add(&vertices[0], GLuint(vertices.size()), &indices[0], GLuint(indices.size()));
+  }
+  g_arenaDrawsAlignment = StreamBuffer::storageAlignment();
+}
 
+/**
+ * Queues shape i of the arena and fills its draw data: a mesh and a point of
+ * the window chosen by a hash of i, spinning at time `t' seconds
+ */
+static void addArenaShape(int i, float t, ArenaDraw *draws) {
+  const uint32_t h = uint32_t(i) * 2654435761u;
+  ArenaDraw& d = draws[g_arena->draw(int(h % uint32_t(g_numArenaMeshes)))];
+
+  const float size = 6 + (h >> 28);
+  const float angle = (h >> 20) / 4096.f * 6.2831853f + t * (i % 2 ? 1.f : -1.f);
+  d.transform[0] = (i * 40503u & 1023) / 1023.f * g_width;
+  d.transform[1] = ((i * 40503u >> 10) & 1023) / 1023.f * g_height;
+  d.transform[2] = size * cos(angle);
+  d.transform[3] = size * sin(angle);
+  d.color[0] = .3f + (h & 255) / 365.f;
+  d.color[1] = .3f + ((h >> 8) & 255) / 365.f;
+  d.color[2] = .3f + ((h >> 16) & 255) / 365.f;
+  d.color[3] = 1;
+}
 
-  safe_glDisableVertexAttribArray(g_triangleShaderState->h_aPosition);
-  safe_glDisableVertexAttribArray(g_triangleShaderState->h_aTexCoord);
-  safe_glDisableVertexAttribArray(g_triangleShaderState->h_aColor);
+/** Draws every shape of the arena with one call */
+static void drawArena() {
+  ArenaShaderState& as = *g_arenaShaderState;
+  glUseProgram(as.program);
+  safe_glUniform2f(as.h_uViewportSize, g_width, g_height);
+
+  /* The draw data go through the stream buffer, like the draw commands */
+  const size_t bytes = g_numArenaDraws * sizeof(ArenaDraw);
+  size_t offset;
+  ArenaDraw *draws = static_cast<ArenaDraw*>(g_streamBuffer->allocate(bytes, g_arenaDrawsAlignment, offset));
+  const float t = glutGet(GLUT_ELAPSED_TIME) / 1000.f;
+  for (int i = 0; i < g_numArenaDraws; ++i)
+    addArenaShape(i, t, draws);
+  g_streamBuffer->commit();
+
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, g_arenaDrawsBinding, g_streamBuffer->buffer(), offset, bytes);
+  g_draws += g_arena->submit(GL_TRIANGLES);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, g_arenaDrawsBinding, 0);
 
   /* Check for errors */
   checkGlErrors();
 }
 
+static double secondsSince(const chrono::steady_clock::time_point& start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/** Prints the average frame time about once a second */
+static void timeFrame() {
+  const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  if (g_framesTimed++ == 0) {
+    g_frameTimerStart = now;
+    return;
+  }
+  const double seconds = chrono::duration<double>(now - g_frameTimerStart).count();
+  if (seconds >= 1) {
+    cout << seconds * 1000 / (g_framesTimed - 1) << " ms per frame";
+    if (g_useInstancing)
+      cout << ", " << g_numInstances << " instances";
+    if (g_useSprites)
+      cout << ", " << g_numSprites << " sprites";
+    if (g_useArena)
+      cout << ", " << g_numArenaDraws << " arena shapes";
+    if (g_streamBuffer)
+      cout << ", " << g_streamBuffer->stalls() << " stream buffer stalls";
+    cout << endl;
+    g_framesTimed = 0;
+  }
+}
+
 /**
  * Display
  *
@@ -230,14 +956,70 @@ static void drawTriangle() {
  * scene. We specify that this is the correct function to call with the
  * glutDisplayFunc() function during initialization.
  */
-static void display(void) {
+static void drawScene() {
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  drawSquare();
-  drawTriangle();
+  const long bindsBefore = g_textureUnits->binds();
+  g_draws = 0;
+  if (g_streamBuffer)
+    g_streamBuffer->beginFrame();
+
+  /* Reports if the upload ring could not be set up */
+  uploadDone(g_uploadStateTicket);
+
+  /* Objects whose textures are still being uploaded are left out of the frame */
+  const bool squareReady = squareTexturesReady();
+  const bool triangleReady = triangleTexturesReady();
+  if (squareReady) {
+    if (g_useInstancing)
+      drawSquareInstances();
+    else
+      drawSquare();
+  }
+  if (triangleReady) {
+    if (g_useInstancing)
+      drawTriangleInstances();
+    else
+      drawTriangle();
+  }
+  if (g_useArena)
+    drawArena();
+  const bool spritesReady = !g_useSprites || (uploadDone(g_texTickets[0]) && uploadDone(g_texTickets[1]) &&
+                                              uploadDone(g_texTickets[2]));
+  if (g_useSprites && spritesReady)
+    drawSprites();
+  if (!squareReady || !triangleReady || !spritesReady)
+    glutPostRedisplay();
+
+  if (g_streamBuffer)
+    g_streamBuffer->endFrame();
+
+  g_textureBinds = g_textureUnits->binds() - bindsBefore;
+}
+
+static void display(void) {
+  if ((g_useFlipbook || g_useInstancing) && g_flipbookFiles.size() > 1) {
+    g_flipbookTime = glutGet(GLUT_ELAPSED_TIME) / 1000.f;
+    glutPostRedisplay();  /* keep animating */
+  }
+  drawScene();
+
+  if (g_textureBinds != g_lastTextureBinds) {
+    cout << "texture binds per frame: " << g_textureBinds << endl;
+    g_lastTextureBinds = g_textureBinds;
+  }
+  if (g_draws != g_lastDraws) {
+    cout << "draws per frame: " << g_draws << endl;
+    g_lastDraws = g_draws;
+  }
 
   glutSwapBuffers();
 
+  if (g_useInstancing || g_useSprites || g_useArena) {
+    timeFrame();
+    glutPostRedisplay();  /* keep timing, and moving the sprites */
+  }
+
   /* check for errors */
   checkGlErrors();
 }
@@ -314,12 +1096,40 @@ static void motion(int x, int y) {
   glutPostRedisplay();
 }
 
+/**
+ * Switches how the square's images are filtered. With sampler objects this
+ * only changes which sampler gets bound; otherwise both textures are updated,
+ * which has to wait until they are loaded. Returns false in that case.
+ */
+static bool setSmoothFiltering(bool smooth) {
+  if (g_samplers) {
+    g_smoothFiltering = smooth;
+    return true;
+  }
+  if (!uploadDone(g_texTickets[0]) || !uploadDone(g_texTickets[1]))
+    return false;
+
+  g_smoothFiltering = smooth;
+  applySamplerState(*g_tex0, squareSampler());
+  applySamplerState(*g_tex1, squareSampler());
+  return true;
+}
+
 static void keyboard(unsigned char key, int x, int y) {
   switch (key) {
   case 'h':
     cout << " ============== H E L P ==============\n\n"
     << "h\t\thelp menu\n"
     << "s\t\tsave screenshot\n"
+    << "a\t\ttoggle texture atlas\n"
+    << "t\t\ttoggle texture array for the square\n"
+    << "f\t\ttoggle smooth filtering of the square\n"
+    << "b\t\ttoggle the shield flipbook animation\n"
+    << "n\t\ttoggle drawing many instances\n"
+    << "[ ]\t\tten times fewer or more instances\n"
+    << "p\t\ttoggle the sprite layer\n"
+    << "o\t\ttoggle sorting sprites by texture\n"
+    << "m\t\ttoggle the shape arena\n"
     << "drag right mouse to change square size\n";
     break;
   case 'q':
@@ -336,6 +1146,70 @@ static void keyboard(unsigned char key, int x, int y) {
   case 'l':
     g_xOffset++;
     break;
+  case 'a':
+    g_useAtlas = !g_useAtlas && g_atlasTex && (g_atlasTicket >= 0 || g_atlasFits);
+    cout << "texture atlas " << (g_useAtlas ? "on" : "off") << endl;
+    break;
+  case 'b':
+    g_useFlipbook = !g_useFlipbook && g_flipbook;
+    cout << "shield flipbook " << (g_useFlipbook ? "on" : "off") << ", "
+         << g_flipbookFiles.size() << " frames" << endl;
+    break;
+  case 'n':
+    if (!g_useInstancing && !GLEW_VERSION_3_3) {
+      cout << "instancing needs OpenGL 3.3" << endl;
+      break;
+    }
+    g_useInstancing = !g_useInstancing && g_flipbook;
+    if (g_useInstancing && !g_squareInstances)
+      initInstances();
+    g_framesTimed = 0;
+    cout << "instancing " << (g_useInstancing ? "on" : "off") << ", " << g_numInstances << " instances" << endl;
+    break;
+  case '[':
+  case ']':
+    g_numInstances = key == ']' ? min(g_numInstances * 10, g_maxInstances) : max(g_numInstances / 10, 1);
+    g_squareInstances.reset();
+    g_triangleInstances.reset();
+    if (g_useInstancing)
+      initInstances();
+    g_framesTimed = 0;
+    cout << g_numInstances << " instances" << endl;
+    break;
+  case 'p':
+    g_useSprites = !g_useSprites;
+    if (g_useSprites && !g_spriteBatch)
+      g_spriteBatch.reset(new SpriteBatch(g_spriteBatchCapacity, g_positionAttrib, g_texCoordAttrib, g_colorAttrib,
+                                          g_streamBuffer.get()));
+    g_framesTimed = 0;
+    cout << "sprites " << (g_useSprites ? "on" : "off") << endl;
+    break;
+  case 'o':
+    g_sortSprites = !g_sortSprites;
+    cout << "sorting sprites by texture " << (g_sortSprites ? "on" : "off") << endl;
+    break;
+  case 'm':
+    if (!g_useArena && !g_arenaShaderState) {
+      cout << "the shape arena needs OpenGL 4.3 and ARB_shader_draw_parameters" << endl;
+      break;
+    }
+    g_useArena = !g_useArena;
+    if (g_useArena && !g_arena)
+      initArena();
+    g_framesTimed = 0;
+    cout << "shape arena " << (g_useArena ? "on" : "off") << ", " << g_numArenaDraws << " shapes, "
+         << g_numArenaMeshes << " meshes" << endl;
+    break;
+  case 't':
+    g_useTextureArray = !g_useTextureArray;
+    cout << "texture array " << (g_useTextureArray ? "on" : "off") << endl;
+    break;
+  case 'f':
+    if (setSmoothFiltering(!g_smoothFiltering))
+      cout << "smooth filtering " << (g_smoothFiltering ? "on" : "off") << endl;
+    else
+      cout << "textures are still loading" << endl;
+    break;
   case 's':
     glFinish();
     writePpmScreenshot(g_width, g_height, "out.ppm");
@@ -365,47 +1239,161 @@ static void initGLState() {
   glPixelStorei(GL_PACK_ALIGNMENT, 1);
   if (!g_Gl2Compatible)
     glEnable(GL_FRAMEBUFFER_SRGB);
+
+  g_textureUnits.reset(new TextureUnits());
+  if (SamplerRegistry::supported())
+    g_samplers.reset(new SamplerRegistry());
 }
 
-static void loadSquareShader(SquareShaderState& ss) {
+/** Binds the attribute names of the shaders to the shared locations, for the next link */
+static void bindAttribLocations(GLuint program) {
+  glBindAttribLocation(program, g_positionAttrib, "aPosition");
+  glBindAttribLocation(program, g_texCoordAttrib, "aTexCoord");
+  glBindAttribLocation(program, g_colorAttrib, "aColor");
+  glBindAttribLocation(program, g_instanceTransformAttrib, "aInstanceTransform");
+  glBindAttribLocation(program, g_instanceTintAttrib, "aInstanceTint");
+}
+
+/**
+ * Loads the square program with the given fragment shader. With textureArray
+ * set, the shader samples both images as layers of a sampler2DArray instead of
+ * from two sampler2Ds.
+ */
+static void loadSquareShader(SquareShaderState& ss, const char *fsFilename, bool textureArray) {
   const GLuint h = ss.program; /* Short hand */
 
-  readAndCompileShader(ss.program, "shaders/asst2-sq-gl3.vshader", "shaders/asst2-sq-gl3.fshader");
- 
+  bindAttribLocations(h);
+  readAndCompileShader(ss.program, "shaders/asst2-sq-gl3.vshader", fsFilename);
+  ss.sourceHash = fnv1a64Value(hashFile(fsFilename),
+                               hashFile("shaders/asst2-sq-gl3.vshader"));
 
   /* Retrieve handles to uniform variables */
   ss.h_uVertexScale = safe_glGetUniformLocation(h, "uVertexScale");
-  ss.h_uTex0 = safe_glGetUniformLocation(h, "uTex0");
-  ss.h_uTex1 = safe_glGetUniformLocation(h, "uTex1");
+  ss.h_uPositionDecode = safe_glGetUniformLocation(h, "uPositionDecode");
+  ss.h_uTex0 = ss.h_uTex1 = ss.h_uTexRect0 = ss.h_uTexRect1 = -1;
+  ss.h_uTexArray = ss.h_uLayer0 = ss.h_uLayer1 = -1;
+  if (textureArray) {
+    ss.h_uTexArray = safe_glGetUniformLocation(h, "uTexArray");
+    ss.h_uLayer0 = safe_glGetUniformLocation(h, "uLayer0");
+    ss.h_uLayer1 = safe_glGetUniformLocation(h, "uLayer1");
+
+    /* The layers never change, so they are set once */
+    ss.program.uniform1i(ss.h_uLayer0, 0);
+    ss.program.uniform1i(ss.h_uLayer1, 1);
+  }
+  else {
+    ss.h_uTex0 = safe_glGetUniformLocation(h, "uTex0");
+    ss.h_uTex1 = safe_glGetUniformLocation(h, "uTex1");
+    ss.h_uTexRect0 = safe_glGetUniformLocation(h, "uTexRect0");
+    ss.h_uTexRect1 = safe_glGetUniformLocation(h, "uTexRect1");
+  }
   ss.h_uXCoefficient = safe_glGetUniformLocation(h, "uXCoefficient");
   ss.h_uYCoefficient = safe_glGetUniformLocation(h, "uYCoefficient");
 
-  /* Retrieve handles to vertex attributes */
-  ss.h_aPosition = safe_glGetAttribLocation(h, "aPosition");
-  ss.h_aTexCoord = safe_glGetAttribLocation(h, "aTexCoord");
-
   if (!g_Gl2Compatible)
     glBindFragDataLocation(h, 0, "fragColor");
   checkGlErrors();
 }
 
-static void loadTriangleShader(TriangleShaderState& ss) {
+/**
+ * Loads the triangle program with the given fragment shader. With flipbook
+ * set, the shader samples the frame for the current time from a
+ * sampler2DArray instead of sampling a sampler2D.
+ */
+static void loadTriangleShader(TriangleShaderState& ss, const char *fsFilename, bool flipbook) {
   const GLuint h = ss.program; /* Short hand */
 
-  readAndCompileShader(ss.program, "shaders/asst2-tr-gl3.vshader", "shaders/asst2-tr-gl3.fshader");
-
+  bindAttribLocations(h);
+  readAndCompileShader(ss.program, "shaders/asst2-tr-gl3.vshader", fsFilename);
+  ss.sourceHash = fnv1a64Value(hashFile(fsFilename),
+                               hashFile("shaders/asst2-tr-gl3.vshader"));
 
   /* Retrieve handles to uniform variables */
-  ss.h_uTex2 = safe_glGetUniformLocation(h, "uTex2");
+  ss.h_uTex2 = ss.h_uTexRect2 = -1;
+  ss.h_uFlipbook = ss.h_uTime = ss.h_uFrameRate = ss.h_uNumFrames = -1;
+  if (flipbook) {
+    ss.h_uFlipbook = safe_glGetUniformLocation(h, "uFlipbook");
+    ss.h_uTime = safe_glGetUniformLocation(h, "uTime");
+    ss.h_uFrameRate = safe_glGetUniformLocation(h, "uFrameRate");
+    ss.h_uNumFrames = safe_glGetUniformLocation(h, "uNumFrames");
+    ss.program.uniform1f(ss.h_uFrameRate, g_flipbookFrameRate);
+  }
+  else {
+    ss.h_uTex2 = safe_glGetUniformLocation(h, "uTex2");
+    ss.h_uTexRect2 = safe_glGetUniformLocation(h, "uTexRect2");
+  }
   ss.h_uXCoefficient = safe_glGetUniformLocation(h, "uXCoefficient");
   ss.h_uYCoefficient = safe_glGetUniformLocation(h, "uYCoefficient");
   ss.h_uXOffset = safe_glGetUniformLocation(h, "uXOffset");
   ss.h_uYOffset = safe_glGetUniformLocation(h, "uYOffset");
+  ss.h_uPositionDecode = safe_glGetUniformLocation(h, "uPositionDecode");
+
+  if (!g_Gl2Compatible)
+    glBindFragDataLocation(h, 0, "fragColor");
+  checkGlErrors();
+}
+
+/**
+ * Loads a program drawing copies of the square or the triangle. With
+ * flipbook set, the array texture holds the frames of the shield's animation
+ * rather than the square's images, and the triangle is moved by the offsets.
+ */
+static void loadInstancedShader(InstancedShaderState& ss, const char *vsFilename, const char *fsFilename,
+                                bool flipbook) {
+  const GLuint h = ss.program; /* Short hand */
+
+  bindAttribLocations(h);
+  readAndCompileShader(ss.program, vsFilename, fsFilename);
+  ss.sourceHash = fnv1a64Value(hashFile(fsFilename), hashFile(vsFilename));
+
+  /* Retrieve handles to uniform variables */
+  ss.h_uTime = ss.h_uFrameRate = ss.h_uNumFrames = ss.h_uXOffset = ss.h_uYOffset = -1;
+  if (flipbook) {
+    ss.h_uTexArray = safe_glGetUniformLocation(h, "uFlipbook");
+    ss.h_uTime = safe_glGetUniformLocation(h, "uTime");
+    ss.h_uFrameRate = safe_glGetUniformLocation(h, "uFrameRate");
+    ss.h_uNumFrames = safe_glGetUniformLocation(h, "uNumFrames");
+    ss.h_uXOffset = safe_glGetUniformLocation(h, "uXOffset");
+    ss.h_uYOffset = safe_glGetUniformLocation(h, "uYOffset");
+    ss.program.uniform1f(ss.h_uFrameRate, g_flipbookFrameRate);
+  }
+  else {
+    ss.h_uTexArray = safe_glGetUniformLocation(h, "uTexArray");
+  }
+  ss.h_uXCoefficient = safe_glGetUniformLocation(h, "uXCoefficient");
+  ss.h_uYCoefficient = safe_glGetUniformLocation(h, "uYCoefficient");
+  ss.h_uPositionDecode = safe_glGetUniformLocation(h, "uPositionDecode");
+
+  if (!g_Gl2Compatible)
+    glBindFragDataLocation(h, 0, "fragColor");
+  checkGlErrors();
+}
+
+static void loadSpriteShader(SpriteShaderState& ss) {
+  const GLuint h = ss.program; /* Short hand */
+
+  bindAttribLocations(h);
+  readAndCompileShader(ss.program, "shaders/sprite-gl3.vshader", "shaders/sprite-gl3.fshader");
+  ss.sourceHash = fnv1a64Value(hashFile("shaders/sprite-gl3.fshader"), hashFile("shaders/sprite-gl3.vshader"));
+
+  /* Retrieve handles to uniform variables */
+  ss.h_uTex = safe_glGetUniformLocation(h, "uTex");
+  ss.h_uViewportSize = safe_glGetUniformLocation(h, "uViewportSize");
+
+  if (!g_Gl2Compatible)
+    glBindFragDataLocation(h, 0, "fragColor");
+  checkGlErrors();
+}
 
-  /* Retrieve handles to vertex attributes */
-  ss.h_aPosition = safe_glGetAttribLocation(h, "aPosition");
-  ss.h_aTexCoord = safe_glGetAttribLocation(h, "aTexCoord");
-  ss.h_aColor = safe_glGetAttribLocation(h, "aColor");
+static void loadArenaShader(ArenaShaderState& as) {
+  const GLuint h = as.program; /* Short hand */
+
+  bindAttribLocations(h);
+  readAndCompileShader(as.program, "shaders/arena-gl4.vshader", "shaders/arena-gl4.fshader");
+  as.sourceHash = fnv1a64Value(hashFile("shaders/arena-gl4.fshader"), hashFile("shaders/arena-gl4.vshader"));
+
+  /* Retrieve handles to uniform variables */
+  as.h_uViewportSize = safe_glGetUniformLocation(h, "uViewportSize");
 
   if (!g_Gl2Compatible)
     glBindFragDataLocation(h, 0, "fragColor");
@@ -414,151 +1402,1232 @@ static void loadTriangleShader(TriangleShaderState& ss) {
 
 static void initShaders() {
   g_squareShaderState.reset(new SquareShaderState);
-  loadSquareShader(*g_squareShaderState);
+  loadSquareShader(*g_squareShaderState, "shaders/asst2-sq-gl3.fshader", false);
+
+  g_squareArrayShaderState.reset(new SquareShaderState);
+  loadSquareShader(*g_squareArrayShaderState, "shaders/asst2-sq-array-gl3.fshader", true);
 
   g_triangleShaderState.reset(new TriangleShaderState);
-  loadTriangleShader(*g_triangleShaderState);
+  loadTriangleShader(*g_triangleShaderState, "shaders/asst2-tr-gl3.fshader", false);
+
+  g_triangleFlipbookShaderState.reset(new TriangleShaderState);
+  loadTriangleShader(*g_triangleFlipbookShaderState, "shaders/asst2-tr-flipbook-gl3.fshader", true);
+
+  g_squareInstancedShaderState.reset(new InstancedShaderState);
+  loadInstancedShader(*g_squareInstancedShaderState, "shaders/asst2-sq-instanced-gl3.vshader",
+                      "shaders/asst2-sq-instanced-gl3.fshader", false);
+
+  g_triangleInstancedShaderState.reset(new InstancedShaderState);
+  loadInstancedShader(*g_triangleInstancedShaderState, "shaders/asst2-tr-instanced-gl3.vshader",
+                      "shaders/asst2-tr-instanced-gl3.fshader", true);
+
+  g_spriteShaderState.reset(new SpriteShaderState);
+  loadSpriteShader(*g_spriteShaderState);
+
+  if (arenaSupported()) {
+    g_arenaShaderState.reset(new ArenaShaderState);
+    loadArenaShader(*g_arenaShaderState);
+  }
+}
+
+/**
+ * Uploads interleaved vertices in `format' and their indices into `g'. With
+ * `compactFormat', the vertices are first packed into it, and the geometry
+ * records it as its format. Indices are stored as GL_UNSIGNED_SHORT when
+ * every vertex can be reached with 16 bits. The attribute setup is recorded
+ * in a vertex array object when the context has them.
+ */
+static void loadGeometry(GeometryPX& g, const VertexFormat& format, const VertexFormat *compactFormat,
+                         const void *vertices, int numVertices, const GLuint *indices, int numIndices) {
+  g.format = &format;
+  g.positionDecode[0] = g.positionDecode[1] = 0;
+  g.positionDecode[2] = g.positionDecode[3] = 1;
+
+  vector<unsigned char> packedVertices;
+  if (compactFormat) {
+    vector<AttributeDecode> decodes(compactFormat->numAttributes);
+    packedVertices.resize(size_t(numVertices) * compactFormat->stride);
+    packVertices(format, vertices, *compactFormat, &packedVertices[0], numVertices, &decodes[0]);
+    for (int i = 0; i < compactFormat->numAttributes; ++i) {
+      if (compactFormat->attributes[i].location == g_positionAttrib) {
+        g.positionDecode[0] = decodes[i].offset[0];
+        g.positionDecode[1] = decodes[i].offset[1];
+        g.positionDecode[2] = decodes[i].scale[0];
+        g.positionDecode[3] = decodes[i].scale[1];
+      }
+    }
+    g.format = compactFormat;
+    vertices = &packedVertices[0];
+  }
+
+  vector<GLushort> shortIndices;
+  const void *indexData = indices;
+  size_t indexSize = sizeof(GLuint);
+  g.indexType = GL_UNSIGNED_INT;
+  if (numVertices <= 65536) {
+    shortIndices.resize(numIndices);
+    packIndices16(indices, &shortIndices[0], numIndices);
+    indexData = &shortIndices[0];
+    indexSize = sizeof(GLushort);
+    g.indexType = GL_UNSIGNED_SHORT;
+  }
+
+  const GLsizeiptr vertexBytes = GLsizeiptr(numVertices) * g.format->stride;
+  const GLsizeiptr indexBytes = GLsizeiptr(numIndices) * indexSize;
+  g.numIndices = numIndices;
+  g.contentHash = fnv1a64(indexData, indexBytes, fnv1a64(vertices, vertexBytes));
+
+  g.vbo.data(vertexBytes, vertices, GL_STATIC_DRAW);
+  g.indexVbo.data(indexBytes, indexData, GL_STATIC_DRAW);
+  checkGlErrors();
+
+  if (GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object) {
+    g.vao.reset(new GlVertexArray());
+    glBindVertexArray(*g.vao);
+    setVertexAttributes(*g.format, g.vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.indexVbo);
+    glBindVertexArray(0);
+    checkGlErrors();
+  }
 }
 
-static void loadSquareGeometry(const GeometryPX& g) {
-	const int vdim = 4; /* 4 vertices */
-	const int idim = 6; /* 6 indices */
-  GLfloat pos[2 * vdim] = {
-    -.5, -.5,
-    .5,  .5,
-    .5,  -.5,
-    -.5, .5,
+static void loadSquareGeometry(GeometryPX& g) {
+  const VertexPT vertices[] = {
+    /* pos       tex */
+    { {-.5, -.5}, {0, 0} },
+    { { .5,  .5}, {1, 1} },
+    { { .5, -.5}, {1, 0} },
+    { {-.5,  .5}, {0, 1} },
   };
 
-  GLfloat tex[2 * vdim] = {
-    0, 0,
-    1, 1,
-    1, 0,
-    0, 1,
+  const GLuint indices[] = { 0, 2, 1, 0, 1, 3 };
+
+  loadGeometry(g, g_vertexPTFormat, g_compactVertices ? &g_compactVertexPTFormat : 0, vertices, 4, indices, 6);
+}
+
+static void loadTriangleGeometry(GeometryPX& g) {
+  /* Center shield in triangle, and give each vertex a different color */
+  const VertexPTC vertices[] = {
+    /* pos             tex            color */
+    { { 0.0, -0.45}, { 0.5, -.60}, {1, 0, 0} },
+    { {-0.45, 0.45}, {-.35,  1.1}, {0, 1, 0} },
+    { { 0.45, 0.45}, {1.35,  1.1}, {0, 0, 1} },
   };
 
-  GLuint indices[idim] = { 0, 2, 1, 0, 1, 3 };
+  const GLuint indices[] = { 0, 2, 1 };
+
+  loadGeometry(g, g_vertexPTCFormat, g_compactVertices ? &g_compactVertexPTCFormat : 0, vertices, 3, indices, 3);
+}
+
+/**
+ * Loads the triangles of OBJ file `filename' into `g', centered and scaled
+ * to fill the square the triangle sits in, and reordered for the vertex
+ * cache when g_optimizeMeshes is set
+ */
+static void loadObjGeometry(GeometryPX& g, const char *filename) {
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<ObjVertex> vertices;
+  vector<uint32_t> indices;
+  ObjStats stats;
+  objRead(filename, vertices, indices, &stats);
+  if (indices.empty())
+    throw runtime_error(string(filename) + " has no faces");
+
+  float lo[2] = { vertices[0].pos[0], vertices[0].pos[1] }, hi[2] = { lo[0], lo[1] };
+  for (size_t i = 1; i < vertices.size(); ++i) {
+    for (int k = 0; k < 2; ++k) {
+      lo[k] = min(lo[k], vertices[i].pos[k]);
+      hi[k] = max(hi[k], vertices[i].pos[k]);
+    }
+  }
+  const float extent = max(hi[0] - lo[0], hi[1] - lo[1]);
+  const float scale = extent > 0 ? .9f / extent : 1;
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    for (int k = 0; k < 2; ++k)
+      vertices[i].pos[k] = (vertices[i].pos[k] - .5f * (lo[k] + hi[k])) * scale;
+  }
+
+  if (g_optimizeMeshes) {
+    const double acmrBefore = vertexCacheMissRatio(&indices[0], indices.size(), vertices.size());
+    optimizeVertexCache(&indices[0], indices.size(), vertices.size());
+    vertices.resize(optimizeVertexFetch(&vertices[0], sizeof(ObjVertex), vertices.size(), &indices[0],
+                                        indices.size()));
+    cout << "vertex cache misses per triangle: " << acmrBefore << " before reordering, "
+         << vertexCacheMissRatio(&indices[0], indices.size(), vertices.size()) << " after" << endl;
+  }
+
+  loadGeometry(g, g_objVertexFormat, g_compactVertices ? &g_compactVertexPTCFormat : 0, &vertices[0],
+               int(vertices.size()), &indices[0], int(indices.size()));
+  cout << "loaded " << filename << ": " << indices.size() / 3 << " triangles, " << vertices.size()
+       << " vertices from " << stats.positions << " positions and " << stats.texCoords
+       << " texture coordinates, in " << secondsSince(start) * 1000 << " ms" << endl;
+}
+
+static void initGeometry() {
+  g_square.reset(new GeometryPX());
+  loadSquareGeometry(*g_square);
+
+  g_triangle.reset(new GeometryPX());
+  if (g_objFilename)
+    loadObjGeometry(*g_triangle, g_objFilename);
+  else
+    loadTriangleGeometry(*g_triangle);
+}
+
+/**
+ * Fills a level of `tex' with RGB pixels, through the upload ring when there
+ * is one. With g_expandToBgra set the pixels go up as BGRA.
+ */
+static void uploadTexSubImage2D(const GlTexture& tex, GLint level, GLsizei width, GLsizei height,
+                                const PackedPixel *pixels) {
+  if (g_expandToBgra) {
+    if (g_uploadRing) {
+      g_uploadRing->texSubImage2DExpanded(tex, level, 0, 0, width, height, pixels);
+    }
+    else {
+      vector<unsigned char> bgra(size_t(width) * height * 4);
+      expandRgbToBgra(pixels, &bgra[0], size_t(width) * height);
+      tex.subImage2D(level, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &bgra[0]);
+    }
+  }
+  else if (g_uploadRing) {
+    g_uploadRing->texSubImage2D(tex, level, 0, 0, width, height,
+                                GL_RGB, GL_UNSIGNED_BYTE, sizeof(PackedPixel), pixels);
+  }
+  else {
+    tex.subImage2D(level, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+  }
+}
+
+/**
+ * Uploads a mip chain uncompressed, level 0 being `pixData'. Unless
+ * `allocate' is set, the texture already has storage of the same size.
+ */
+static void uploadMipChain(const GlTexture& tex, const PackedPixel *pixData, int texWidth, int texHeight,
+                           bool allocate) {
+  vector<MipLevel> mips;
+  buildMipChain(pixData, texWidth, texHeight, !g_Gl2Compatible, mips);
+
+  const GLenum internalFormat = g_expandToBgra ? (g_Gl2Compatible ? GL_RGBA8 : GL_SRGB8_ALPHA8)
+                                               : (g_Gl2Compatible ? GL_RGB8 : GL_SRGB8);
+  if (allocate)
+    tex.storage2D(GLsizei(mips.size() + 1), internalFormat, texWidth, texHeight);
+
+  // BGRA rows are always 4-byte aligned
+  if (g_expandToBgra)
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  uploadTexSubImage2D(tex, 0, texWidth, texHeight, pixData);
+  for (size_t i = 0; i < mips.size(); ++i)
+    uploadTexSubImage2D(tex, GLint(i + 1), mips[i].width, mips[i].height, &mips[i].pixels[0]);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+}
+
+/**
+ * Picks the block format to compress textures to and its GL internal format.
+ * Returns false if the context can sample neither.
+ */
+static bool chooseCompressedFormat(BlockFormat& format, GLenum& internalFormat) {
+  if (GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc) {
+    format = BLOCK_BC7;
+    internalFormat = g_Gl2Compatible ? GL_COMPRESSED_RGBA_BPTC_UNORM : GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    return true;
+  }
+  if (GLEW_EXT_texture_compression_s3tc && (g_Gl2Compatible || GLEW_EXT_texture_sRGB)) {
+    format = BLOCK_BC1;
+    internalFormat = g_Gl2Compatible ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Uploads a block compressed mip chain, level 0 being `pixData'. The chain
+ * comes from the disk cache when it has been compressed before. Unless
+ * `allocate' is set, the texture already has storage of the same size.
+ * Throws runtime_error if the image is empty.
+ */
+static void uploadCompressedMipChain(const GlTexture& tex, const PackedPixel *pixData, int texWidth, int texHeight,
+                                     uint64_t contentHash, BlockFormat format, GLenum internalFormat,
+                                     const char *ppmFilename, bool allocate) {
+  if (texWidth <= 0 || texHeight <= 0)
+    throw runtime_error(string("texture: ") + ppmFilename + " is empty");
+
+  // The mip levels differ depending on whether they were filtered in linear light
+  const uint64_t key = fnv1a64Value(g_Gl2Compatible, contentHash);
+  vector<CompressedLevel> levels;
+  const bool cached = readCompressedCache(g_textureCacheDir, key, format, levels) &&
+                      !levels.empty() && levels[0].width == texWidth && levels[0].height == texHeight;
+  if (!cached) {
+    vector<MipLevel> mips;
+    buildMipChain(pixData, texWidth, texHeight, !g_Gl2Compatible, mips);
+
+    levels.resize(mips.size() + 1);
+    levels[0].width = texWidth;
+    levels[0].height = texHeight;
+    compressImage(format, pixData, texWidth, texHeight, levels[0].blocks);
+    for (size_t i = 0; i < mips.size(); ++i) {
+      levels[i + 1].width = mips[i].width;
+      levels[i + 1].height = mips[i].height;
+      compressImage(format, &mips[i].pixels[0], mips[i].width, mips[i].height, levels[i + 1].blocks);
+    }
+    writeCompressedCache(g_textureCacheDir, key, format, levels);
+  }
+
+  // Without texture storage, the levels are allocated with glTexImage2D,
+  // which takes the compressed formats too
+  if (allocate)
+    tex.storage2D(GLsizei(levels.size()), internalFormat, texWidth, texHeight);
+  for (size_t i = 0; i < levels.size(); ++i) {
+    tex.compressedSubImage2D(GLint(i), 0, 0, levels[i].width, levels[i].height, internalFormat,
+                             GLsizei(levels[i].blocks.size()), &levels[i].blocks[0]);
+  }
+}
+
+/** Uploads an image with its mip chain to `tex', see loadTexture() */
+static uint64_t uploadImage(const GlTexture& tex, const PackedPixel *pixData, int texWidth, int texHeight, uint64_t contentHash,
+                            const char *ppmFilename, bool allocate) {
+  BlockFormat format;
+  GLenum internalFormat = GL_NONE;
+  if (g_compressTextures && chooseCompressedFormat(format, internalFormat))
+    uploadCompressedMipChain(tex, pixData, texWidth, texHeight, contentHash, format, internalFormat, ppmFilename,
+                             allocate);
+  else
+    uploadMipChain(tex, pixData, texWidth, texHeight, allocate);
+  return fnv1a64Value(internalFormat, contentHash);
+}
+
+/**
+ * Loads an image with its full mip chain, built on the CPU in linear light to
+ * match the GL_SRGB internal format. The chain is block compressed when the
+ * context supports it and g_compressTextures is set. Storage is immutable
+ * (glTexStorage2D) when the driver supports it. Without sampler objects,
+ * `sampler' is set on the texture. Returns a hash of the image contents and
+ * of how they are stored.
+ */
+static uint64_t loadTexture(const GlTexture& tex, const char *ppmFilename, const SamplerState& sampler) {
+  int texWidth, texHeight;
+  uint64_t contentHash;
+  const PackedPixel *pixData = ppmReadShared(ppmFilename, texWidth, texHeight, &contentHash);
+
+  const uint64_t hash = uploadImage(tex, pixData, texWidth, texHeight, contentHash, ppmFilename, true);
+
+  /* glTexParameteri should be called after glTexImage2D */
+  if (!g_samplers)
+    applySamplerState(tex, sampler);
 
-  glBindBuffer(GL_ARRAY_BUFFER, g.posVbo);
-  glBufferData(
-    GL_ARRAY_BUFFER,
-    2*vdim*sizeof(GLfloat),
-    pos,
-    GL_STATIC_DRAW);
   checkGlErrors();
+  return hash;
+}
+
+/**
+ * Uploads the current contents of an image file into the texture loaded
+ * from it by loadTexture(), keeping its storage. If the image no longer has
+ * the texture's size nothing is uploaded and `resized' is set instead. Errors
+ * are reported and leave the texture as it was, as the file may be saved
+ * again shortly.
+ */
+static void reloadTexture(const GlTexture& tex, const char *ppmFilename, uint64_t *contentHash, bool *resized) {
+  try {
+    int texWidth, texHeight;
+    uint64_t hash;
+    const PackedPixel *pixData = ppmReadShared(ppmFilename, texWidth, texHeight, &hash);
+
+    if (texWidth != tex.levelParameteri(0, GL_TEXTURE_WIDTH) ||
+        texHeight != tex.levelParameteri(0, GL_TEXTURE_HEIGHT)) {
+      *resized = true;
+      return;
+    }
+    *contentHash = uploadImage(tex, pixData, texWidth, texHeight, hash, ppmFilename, false);
+    checkGlErrors();
+  }
+  catch (const runtime_error& e) {
+    cerr << "WARN: cannot reload " << ppmFilename << ": " << e.what() << endl;
+  }
+}
+
+/**
+ * Upsamples an image by pixel replication (nearest neighbour) to
+ * dstWidth x dstHeight. For integer ratios this samples exactly like the
+ * original texture would with GL_NEAREST.
+ */
+static void resizeNearest(const PackedPixel *src, int srcWidth, int srcHeight,
+                          vector<PackedPixel>& dst, int dstWidth, int dstHeight) {
+  dst.resize(dstWidth * dstHeight);
+  for (int y = 0; y < dstHeight; ++y) {
+    const PackedPixel *srcRow = src + (y * srcHeight / dstHeight) * srcWidth;
+    for (int x = 0; x < dstWidth; ++x)
+      dst[y * dstWidth + x] = srcRow[x * srcWidth / dstWidth];
+  }
+}
+
+/**
+ * Loads several images as the layers of one GL_TEXTURE_2D_ARRAY, in order.
+ * All layers share the size of the largest image; smaller ones are resampled
+ * to it. Returns a hash of the image contents.
+ */
+static uint64_t loadTextureArray(const GlTexture& tex, const char * const ppmFilenames[], int numLayers) {
+  vector<const PackedPixel*> layers(numLayers);
+  vector<int> widths(numLayers), heights(numLayers);
+  int texWidth = 0, texHeight = 0;
+  uint64_t hash = FNV1A64_SEED;
+  for (int i = 0; i < numLayers; ++i) {
+    uint64_t contentHash;
+    layers[i] = ppmReadShared(ppmFilenames[i], widths[i], heights[i], &contentHash);
+    hash = fnv1a64Value(contentHash, hash);
+    texWidth = max(texWidth, widths[i]);
+    texHeight = max(texHeight, heights[i]);
+  }
+
+  tex.storage3D(1, g_Gl2Compatible ? GL_RGB8 : GL_SRGB8, texWidth, texHeight, numLayers);
+
+  vector<PackedPixel> resized;
+  for (int i = 0; i < numLayers; ++i) {
+    const PackedPixel *pixData = layers[i];
+    if (widths[i] != texWidth || heights[i] != texHeight) {
+      resizeNearest(layers[i], widths[i], heights[i], resized, texWidth, texHeight);
+      pixData = &resized[0];
+    }
+    if (g_uploadRing)
+      g_uploadRing->texSubImage3D(tex, 0, 0, 0, i, texWidth, texHeight,
+                                  GL_RGB, GL_UNSIGNED_BYTE, sizeof(PackedPixel), pixData);
+    else
+      tex.subImage3D(0, 0, 0, i, texWidth, texHeight, 1, GL_RGB, GL_UNSIGNED_BYTE, pixData);
+  }
+  if (!g_samplers)
+    applySamplerState(tex, g_unfilteredSampler);
 
-  glBindBuffer(GL_ARRAY_BUFFER, g.texVbo);
-  glBufferData(
-    GL_ARRAY_BUFFER,
-    2*vdim*sizeof(GLfloat),
-    tex,
-    GL_STATIC_DRAW);
   checkGlErrors();
+  return hash;
+}
+
+/**
+ * Runs `job' on the uploader thread and returns its ticket, or runs it right
+ * away and returns -1 when there is no uploader.
+ */
+static int uploadAsync(const std::function<void()>& job) {
+  if (g_uploader)
+    return g_uploader->submit(job);
+  job();
+  return -1;
+}
+
+static void loadTextureJob(const GlTexture& tex, const char *ppmFilename, const SamplerState& sampler,
+                           uint64_t *contentHash) {
+  *contentHash = loadTexture(tex, ppmFilename, sampler);
+}
+
+static void initTextureArray() {
+  g_texArray.reset(new GlTexture(GL_TEXTURE_2D_ARRAY));
+  g_texArrayTicket = uploadAsync(std::bind(loadTextureArray, std::cref(*g_texArray), g_texFiles, 2));
+}
+
+/**
+ * Loads the frames of the flipbook, g_flipbookPattern numbered from 0 or 1,
+ * into the layers of one array texture
+ */
+static void initFlipbook() {
+  GLint maxLayers;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+  g_flipbookFiles.clear();
+  for (int i = 0; int(g_flipbookFiles.size()) < maxLayers; ++i) {
+    char filename[64];
+    sprintf(filename, g_flipbookPattern, i);
+    FILE *f = fopen(filename, "rb");
+    if (!f) {
+      if (i == 0)
+        continue;
+      break;
+    }
+    fclose(f);
+    g_flipbookFiles.push_back(filename);
+  }
+  if (g_flipbookFiles.empty())
+    g_flipbookFiles.push_back(g_texFiles[2]);
+
+  g_flipbookFileNames.clear();
+  for (size_t i = 0; i < g_flipbookFiles.size(); ++i)
+    g_flipbookFileNames.push_back(g_flipbookFiles[i].c_str());
+
+  g_flipbook.reset(new GlTexture(GL_TEXTURE_2D_ARRAY));
+  g_flipbookTicket = uploadAsync(std::bind(loadTextureArray, std::cref(*g_flipbook), &g_flipbookFileNames[0],
+                                           int(g_flipbookFileNames.size())));
+}
+
+/** The shared pointers to the three textures, indexed like g_texFiles */
+static shared_ptr<GlTexture>& textureRef(int i) {
+  return i == 0 ? g_tex0 : i == 1 ? g_tex1 : g_tex2;
+}
+
+static const SamplerState& textureSampler(int i) {
+  return i == 2 ? g_blockySampler : squareSampler();
+}
+
+/** Sets up the context textures are loaded on */
+static void initUploadState() {
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (UploadRing::supported() && !g_uploadRing)
+    g_uploadRing.reset(new UploadRing(g_uploadRingBytes));
+}
+
+static void initTextures() {
+  /* The texture names are created here so they can be bound before the
+   * uploads finish; the uploads themselves run on the uploader thread */
+  g_tex0.reset(new GlTexture(GL_TEXTURE_2D));
+  g_tex1.reset(new GlTexture(GL_TEXTURE_2D));
+  g_tex2.reset(new GlTexture(GL_TEXTURE_2D));
+
+  g_uploadStateTicket = uploadAsync(initUploadState);
+
+  for (int i = 0; i < 3; ++i) {
+    g_texTickets[i] = uploadAsync(std::bind(loadTextureJob, std::cref(*textureRef(i)), g_texFiles[i],
+                                            std::cref(textureSampler(i)), &g_textureHashes[i]));
+  }
+}
+
+static void loadAtlasPage(const GlTexture& tex, const TextureAtlas::Page& page) {
+  tex.storage2D(1, g_Gl2Compatible ? GL_RGB8 : GL_SRGB8, page.width, page.height);
+  tex.subImage2D(0, 0, 0, page.width, page.height, GL_RGB, GL_UNSIGNED_BYTE, &page.pixels[0]);
+  if (!g_samplers)
+    applySamplerState(tex, g_unfilteredSampler);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.indexVbo);
-  glBufferData(
-	  GL_ELEMENT_ARRAY_BUFFER,
-	  idim * sizeof(GLuint),
-	  indices,
-	  GL_STATIC_DRAW);
   checkGlErrors();
 }
 
-static void loadTriangleGeometry(const GeometryPX& g) {
-	const int vdim = 3; /* 3 vertices */
-	const int idim = 3; /* 3 indices */
+/**
+ * Decodes the images of initTextures(), packs them into `atlas' and uploads
+ * its page. Sets g_atlasFits, and leaves the texture empty if the images do
+ * not fit on one page.
+ */
+static void loadAtlas(const GlTexture& tex, const shared_ptr<TextureAtlas>& atlas) {
+  int width, height;
+  const PackedPixel *pixels = ppmReadShared("smiley.ppm", width, height);
+  g_atlasImage0 = atlas->add(width, height, pixels);
+  pixels = ppmReadShared("reachup.ppm", width, height);
+  g_atlasImage1 = atlas->add(width, height, pixels);
+  pixels = ppmReadShared("shield.ppm", width, height);
+  g_atlasImage2 = atlas->add(width, height, pixels);
+  atlas->pack();
+
+  g_atlasFits = atlas->numPages() == 1;
+  if (!g_atlasFits) {
+    cerr << "WARN: textures do not fit in one atlas page, atlas disabled" << endl;
+    return;
+  }
+  loadAtlasPage(tex, atlas->page(0));
+}
 
-  GLfloat pos[2 * vdim] = {
-    0.0, -0.45,
-    -0.45, 0.45,
-    0.45, 0.45
-  };
+/**
+ * Packs the same images as initTextures() into a single atlas texture. Like
+ * the textures, the images are decoded and packed on the uploader thread; the
+ * atlas is turned off once it is done if it does not fit on one page.
+ */
+static void initAtlas() {
+  GLint maxTextureSize;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  g_atlas.reset(new TextureAtlas(min(g_atlasPageSize, int(maxTextureSize)), 1));
+  g_atlasTex.reset(new GlTexture(GL_TEXTURE_2D));
+  g_atlasTicket = uploadAsync(std::bind(loadAtlas, std::cref(*g_atlasTex), g_atlas));
+}
 
-  /* Center shield in triangle */
-  GLfloat tex[2 * vdim] = {
-    0.5, -.60,
-    -.35, 1.1,
-    1.35, 1.1
-  };
+/**
+ * Loads everything that comes from image `file' again: its texture, in place
+ * when its size is unchanged, and the atlas, texture array and flipbook it is
+ * part of. Files that are not one of the texture images are ignored.
+ * Returns false, having done nothing, while an earlier upload of any of them
+ * is still running.
+ */
+static bool reloadImage(const string& file) {
+  int i = 0;
+  while (i < 3 && file != g_texFiles[i])
+    ++i;
+  if (i == 3)
+    return true;
+  const bool inArray = i < 2;
+  const bool inFlipbook = g_flipbook && g_flipbookFiles.size() == 1 && g_flipbookFiles[0] == file;
+  if (!uploadDone(g_texTickets[i]) || !uploadDone(g_reloadTickets[i]) || !uploadDone(g_atlasTicket) ||
+      (inArray && !uploadDone(g_texArrayTicket)) || (inFlipbook && !uploadDone(g_flipbookTicket)))
+    return false;
+
+  g_reloadTickets[i] = uploadAsync(std::bind(reloadTexture, std::cref(*textureRef(i)), g_texFiles[i],
+                                             &g_textureHashes[i], &g_texResized[i]));
+  if (g_atlas)
+    initAtlas();
+  if (inArray)
+    initTextureArray();
+  if (inFlipbook)
+    initFlipbook();
+
+  /* The textures replaced above were unbound when they were deleted, and
+   * their replacements may well have been given the same names */
+  if (g_atlas || inArray || inFlipbook)
+    g_textureUnits->invalidate();
+  return true;
+}
+
+/**
+ * Relinks the programs built from shader `file' into new programs, which
+ * replace the old ones only if they link, so a shader saved with an error in
+ * it leaves the last working one drawing
+ */
+static void reloadShader(const string& file) {
+  try {
+    if (file == "shaders/asst2-sq-gl3.vshader" || file == "shaders/asst2-sq-gl3.fshader") {
+      shared_ptr<SquareShaderState> ss(new SquareShaderState);
+      loadSquareShader(*ss, "shaders/asst2-sq-gl3.fshader", false);
+      g_squareShaderState = ss;
+    }
+    if (file == "shaders/asst2-sq-gl3.vshader" || file == "shaders/asst2-sq-array-gl3.fshader") {
+      shared_ptr<SquareShaderState> ss(new SquareShaderState);
+      loadSquareShader(*ss, "shaders/asst2-sq-array-gl3.fshader", true);
+      g_squareArrayShaderState = ss;
+    }
+    if (file == "shaders/asst2-tr-gl3.vshader" || file == "shaders/asst2-tr-gl3.fshader") {
+      shared_ptr<TriangleShaderState> ts(new TriangleShaderState);
+      loadTriangleShader(*ts, "shaders/asst2-tr-gl3.fshader", false);
+      g_triangleShaderState = ts;
+    }
+    if (file == "shaders/asst2-tr-gl3.vshader" || file == "shaders/asst2-tr-flipbook-gl3.fshader") {
+      shared_ptr<TriangleShaderState> ts(new TriangleShaderState);
+      loadTriangleShader(*ts, "shaders/asst2-tr-flipbook-gl3.fshader", true);
+      g_triangleFlipbookShaderState = ts;
+    }
+    if (file == "shaders/asst2-sq-instanced-gl3.vshader" || file == "shaders/asst2-sq-instanced-gl3.fshader") {
+      shared_ptr<InstancedShaderState> ss(new InstancedShaderState);
+      loadInstancedShader(*ss, "shaders/asst2-sq-instanced-gl3.vshader", "shaders/asst2-sq-instanced-gl3.fshader",
+                          false);
+      g_squareInstancedShaderState = ss;
+    }
+    if (file == "shaders/asst2-tr-instanced-gl3.vshader" || file == "shaders/asst2-tr-instanced-gl3.fshader") {
+      shared_ptr<InstancedShaderState> ts(new InstancedShaderState);
+      loadInstancedShader(*ts, "shaders/asst2-tr-instanced-gl3.vshader", "shaders/asst2-tr-instanced-gl3.fshader",
+                          true);
+      g_triangleInstancedShaderState = ts;
+    }
+    if (file == "shaders/sprite-gl3.vshader" || file == "shaders/sprite-gl3.fshader") {
+      shared_ptr<SpriteShaderState> ss(new SpriteShaderState);
+      loadSpriteShader(*ss);
+      g_spriteShaderState = ss;
+    }
+    if (g_arenaShaderState && (file == "shaders/arena-gl4.vshader" || file == "shaders/arena-gl4.fshader")) {
+      shared_ptr<ArenaShaderState> as(new ArenaShaderState);
+      loadArenaShader(*as);
+      g_arenaShaderState = as;
+    }
+    cout << "reloaded " << file << endl;
+  }
+  catch (const runtime_error& e) {
+    cerr << "WARN: cannot reload " << file << ": " << e.what() << endl;
+  }
+  // The sampler uniforms of the new programs are unset
+  g_textureUnits->invalidate();
+}
+
+/**
+ * Timer callback that reloads whatever was loaded from the files saved since
+ * the last tick. Reloads that have to wait for an upload are retried on the
+ * next tick.
+ */
+static void pollFileChanges(int) {
+  vector<string> changed;
+  g_fileWatcher->poll(changed);
+  g_pendingReloads.insert(changed.begin(), changed.end());
+
+  bool redraw = false;
+  for (set<string>::iterator i = g_pendingReloads.begin(); i != g_pendingReloads.end();) {
+    if (i->compare(0, 8, "shaders/") == 0)
+      reloadShader(*i);
+    else if (!reloadImage(*i)) {
+      ++i;
+      continue;
+    }
+    g_pendingReloads.erase(i++);
+    redraw = true;
+  }
+
+  // Textures whose image changed size get new storage
+  for (int i = 0; i < 3; ++i) {
+    /* The texture was changed in place on the uploader's context, which this
+     * context is only guaranteed to see once it binds the texture again */
+    if (g_reloadTickets[i] >= 0 && uploadDone(g_reloadTickets[i])) {
+      g_textureUnits->invalidate();
+      redraw = true;
+    }
+    if (!g_texResized[i] || g_reloadTickets[i] >= 0)
+      continue;
+    g_texResized[i] = false;
+    textureRef(i).reset(new GlTexture(GL_TEXTURE_2D));
+    g_texTickets[i] = uploadAsync(std::bind(loadTextureJob, std::cref(*textureRef(i)), g_texFiles[i],
+                                            std::cref(textureSampler(i)), &g_textureHashes[i]));
+    g_textureUnits->invalidate();
+  }
 
-  /* Give each vertex a different color */
-  GLfloat color[3 * vdim] = {
-    1, 0, 0,
-    0, 1, 0,
-    0, 0, 1
+  if (redraw)
+    glutPostRedisplay();
+  glutTimerFunc(g_reloadPollMs, pollFileChanges, 0);
+}
+
+/** Watches the files the textures and shaders are loaded from */
+static void initFileWatcher() {
+  static const char *shaderFiles[] = {
+    "shaders/asst2-sq-gl3.vshader", "shaders/asst2-sq-gl3.fshader", "shaders/asst2-sq-array-gl3.fshader",
+    "shaders/asst2-tr-gl3.vshader", "shaders/asst2-tr-gl3.fshader", "shaders/asst2-tr-flipbook-gl3.fshader",
+    "shaders/asst2-sq-instanced-gl3.vshader", "shaders/asst2-sq-instanced-gl3.fshader",
+    "shaders/asst2-tr-instanced-gl3.vshader", "shaders/asst2-tr-instanced-gl3.fshader",
+    "shaders/sprite-gl3.vshader", "shaders/sprite-gl3.fshader",
+    "shaders/arena-gl4.vshader", "shaders/arena-gl4.fshader",
   };
 
-  GLuint indices[idim] = { 0, 2, 1};
+  g_fileWatcher.reset(new FileWatcher());
+  for (int i = 0; i < 3; ++i)
+    g_fileWatcher->watch(g_texFiles[i]);
+  for (size_t i = 0; i < sizeof(shaderFiles) / sizeof(shaderFiles[0]); ++i)
+    g_fileWatcher->watch(shaderFiles[i]);
+  glutTimerFunc(g_reloadPollMs, pollFileChanges, 0);
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, g.posVbo);
-  glBufferData(
-    GL_ARRAY_BUFFER,
-    2*vdim*sizeof(GLfloat),
-    pos,
-    GL_STATIC_DRAW);
-  checkGlErrors();
+static void initOffscreenTarget() {
+  g_offscreen.reset(new OffscreenTarget());
+
+  glBindRenderbuffer(GL_RENDERBUFFER, g_offscreen->color);
+  glRenderbufferStorage(GL_RENDERBUFFER, g_Gl2Compatible ? GL_RGBA8 : GL_SRGB8_ALPHA8, g_width, g_height);
+  glBindRenderbuffer(GL_RENDERBUFFER, g_offscreen->depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, g_width, g_height);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, g_offscreen->fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, g_offscreen->color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_offscreen->depth);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    throw runtime_error("Error: offscreen framebuffer is incomplete");
 
-  glBindBuffer(GL_ARRAY_BUFFER, g.texVbo);
-  glBufferData(
-    GL_ARRAY_BUFFER,
-    2*vdim*sizeof(GLfloat),
-    tex,
-    GL_STATIC_DRAW);
+  glViewport(0, 0, g_width, g_height);
   checkGlErrors();
+}
+
+static void printUploadStats() {
+  if (g_uploadRing) {
+    cout << "streamed " << g_uploadRing->bytesUploaded() / 1024 << " KB of texels through the "
+         << (g_uploadRing->persistent() ? "persistently mapped" : "mapped") << " upload ring, "
+         << g_uploadRing->stalls() << " stalls" << endl;
+  }
+}
+
+/* R E N D E R   F A R M **********************************************/
+
+/**
+ * Runs inside each farm worker, and in the parent if it renders frames no
+ * worker got to: every worker gets its own GLUT window
+ * and GL context, which is hidden and only used to render into an offscreen
+ * framebuffer.
+ */
+static void initFarmWorker(int) {
+  initGlutState(g_argc, g_argv);
+  glutHideWindow();
+
+  glewInit();
+  if ((!g_Gl2Compatible) && !GLEW_VERSION_3_0)
+    throw runtime_error("Error: card/driver does not support OpenGL Shading Language v1.3");
+
+  initGLState();
+  initShaders();
+  initGeometry();
+  initTextures();
+  initOffscreenTarget();
+
+  g_renderCache.reset(new RenderCache(g_renderCacheDir, g_renderCacheBytes));
+}
 
-  glBindBuffer(GL_ARRAY_BUFFER, g.colorVbo);
-  glBufferData(
-    GL_ARRAY_BUFFER,
-    3*vdim*sizeof(GLfloat),
-    color,
-    GL_STATIC_DRAW);
+/**
+ * Hash of everything drawScene() output depends on: the renderer version, the
+ * modes, the viewport, the uniform values, and the geometry, texture and
+ * shader contents.
+ */
+static uint64_t sceneStateHash() {
+  const float scaleCoefficient = min(g_width / g_initialWidth, g_height / g_initialHeight);
+
+  uint64_t h = FNV1A64_SEED;
+  h = fnv1a64Value(g_rendererVersion, h);
+  h = fnv1a64Value(g_Gl2Compatible, h);
+  h = fnv1a64Value(g_compressTextures, h);
+  h = fnv1a64Value(g_expandToBgra, h);
+  h = fnv1a64Value(g_compactVertices, h);
+  h = fnv1a64Value(g_useFlipbook, h);
+  h = fnv1a64Value(g_useInstancing, h);
+  h = fnv1a64Value(g_useSprites, h);
+  h = fnv1a64Value(g_useArena, h);
+  if (g_useFlipbook || g_useInstancing)
+    h = fnv1a64Value(g_flipbookTime, h);
+  if (g_useInstancing)
+    h = fnv1a64Value(g_numInstances, h);
+  h = fnv1a64Value(g_useAtlas, h);
+  h = fnv1a64Value(g_useTextureArray, h);
+  h = fnv1a64Value(g_smoothFiltering, h);
+  h = fnv1a64Value(g_width, h);
+  h = fnv1a64Value(g_height, h);
+  h = fnv1a64Value(g_objScale, h);
+  h = fnv1a64Value(float(g_initialWidth / g_width * scaleCoefficient), h);
+  h = fnv1a64Value(float(g_initialHeight / g_height * scaleCoefficient), h);
+  h = fnv1a64Value(float(g_xOffset * .05), h);
+  h = fnv1a64Value(float(g_yOffset * .05), h);
+  h = fnv1a64Value(g_square->contentHash, h);
+  h = fnv1a64Value(g_triangle->contentHash, h);
+  for (int i = 0; i < 3; ++i)
+    h = fnv1a64Value(g_textureHashes[i], h);
+  if (g_useInstancing) {
+    h = fnv1a64Value(g_squareInstancedShaderState->sourceHash, h);
+    h = fnv1a64Value(g_triangleInstancedShaderState->sourceHash, h);
+  }
+  else {
+    h = fnv1a64Value((g_useTextureArray ? g_squareArrayShaderState : g_squareShaderState)->sourceHash, h);
+    h = fnv1a64Value((g_useFlipbook ? g_triangleFlipbookShaderState : g_triangleShaderState)->sourceHash, h);
+  }
+  return h;
+}
+
+static void renderFarmJob(const FarmJob& job, const char *outFilename) {
+  g_xOffset = job.xOffset;
+  g_yOffset = job.yOffset;
+  g_objScale = job.objScale;
+
+  const uint64_t key = sceneStateHash();
+  if (g_renderCache->fetch(key, outFilename))
+    return;
+
+  drawScene();
+  glFinish();
+  writePpmScreenshot(g_width, g_height, outFilename);
   checkGlErrors();
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.indexVbo);
-  glBufferData(
-      GL_ELEMENT_ARRAY_BUFFER,
-      idim * sizeof(GLuint),
-      indices,
-      GL_STATIC_DRAW);
+  g_renderCache->store(key, outFilename);
+}
+
+static void finishFarmWorker(int workerIndex) {
+  cout << "worker " << workerIndex << " ";
+  g_renderCache->printStats(cout);
+}
+
+/**
+ * Renders `numFrames' frames of the triangle sweeping across the square while
+ * the square grows, spread over `numWorkers' processes.
+ */
+static int runFarmMode(int numWorkers, int numFrames) {
+  vector<FarmJob> jobs(numFrames);
+  for (int i = 0; i < numFrames; ++i) {
+    const float t = numFrames > 1 ? float(i) / (numFrames - 1) : 0.f;
+    jobs[i].frame = i;
+    jobs[i].xOffset = int(-10 + 20 * t);
+    jobs[i].yOffset = 0;
+    jobs[i].objScale = 0.5f + t;
+  }
+
+  vector<string> outputs = runRenderFarm(jobs, numWorkers, "farm", initFarmWorker, renderFarmJob, finishFarmWorker);
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    if (!outputs[i].empty())
+      cout << outputs[i] << "\n";
+  }
+  return 0;
+}
+
+/* U P L O A D   B E N C H M A R K ************************************/
+
+/**
+ * Times `iterations' uploads of level 0 of a texture, after one untimed
+ * upload, and returns the throughput in megatexels per second. With `expand'
+ * set, the RGB pixels are expanded to BGRA on every iteration, as part of
+ * the upload.
+ */
+static double timeUploads(GLuint texHandle, int width, int height, int iterations, GLenum format,
+                          const void *pixels, const PackedPixel *expand, unsigned char *expanded) {
+  glBindTexture(GL_TEXTURE_2D, texHandle);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format,
+                  format == GL_BGRA ? GL_UNSIGNED_INT_8_8_8_8_REV : GL_UNSIGNED_BYTE, pixels);
+  glFinish();
+
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    if (expand)
+      expandRgbToBgra(expand, expanded, size_t(width) * height);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format,
+                    format == GL_BGRA ? GL_UNSIGNED_INT_8_8_8_8_REV : GL_UNSIGNED_BYTE, pixels);
+  }
+  glFinish();
   checkGlErrors();
+  return double(width) * height * iterations / 1e6 / secondsSince(start);
+}
+
+/**
+ * Compares uploading reachup.ppm as tightly packed RGB against expanding it
+ * to BGRA and uploading that with 4-byte alignment, on a hidden window. The
+ * expansion alone is timed too, with and without SIMD.
+ */
+static int runUploadBenchmark(int iterations) {
+  initGlutState(g_argc, g_argv);
+  glutHideWindow();
+  glewInit();
+
+  int width, height;
+  const PackedPixel *pixels = ppmReadShared("reachup.ppm", width, height);
+  const size_t count = size_t(width) * height;
+  vector<unsigned char> bgra(count * 4);
+
+  cout << "upload benchmark: " << width << "x" << height << ", " << iterations << " iterations, "
+       << glGetString(GL_RENDERER) << endl;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    expandRgbToBgraScalar(pixels, &bgra[0], count);
+  cout << "  expand to BGRA, scalar:      " << count * iterations / 1e6 / secondsSince(start) << " Mtexels/s" << endl;
+
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i)
+    expandRgbToBgra(pixels, &bgra[0], count);
+  cout << "  expand to BGRA:              " << count * iterations / 1e6 / secondsSince(start) << " Mtexels/s" << endl;
+
+  GlTexture rgbTex, bgraTex;
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, rgbTex);
+  glTexImage2D(GL_TEXTURE_2D, 0, g_Gl2Compatible ? GL_RGB8 : GL_SRGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_2D, bgraTex);
+  glTexImage2D(GL_TEXTURE_2D, 0, g_Gl2Compatible ? GL_RGBA8 : GL_SRGB8_ALPHA8, width, height, 0, GL_BGRA,
+               GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
 
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  cout << "  RGB, 1-byte alignment:       "
+       << timeUploads(rgbTex, width, height, iterations, GL_RGB, pixels, NULL, NULL) << " Mtexels/s" << endl;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  cout << "  BGRA, 4-byte alignment:      "
+       << timeUploads(bgraTex, width, height, iterations, GL_BGRA, &bgra[0], NULL, NULL) << " Mtexels/s" << endl;
+  cout << "  expand + BGRA upload:        "
+       << timeUploads(bgraTex, width, height, iterations, GL_BGRA, &bgra[0], pixels, &bgra[0]) << " Mtexels/s" << endl;
+  return 0;
 }
 
-static void initGeometry() {
-  g_square.reset(new GeometryPX());
-  loadSquareGeometry(*g_square);
+/* T I L E   V I E W E R **********************************************/
 
-  g_triangle.reset(new GeometryPX());
-  loadTriangleGeometry(*g_triangle);
+/**
+ * State of the --view mode, which pans and zooms over an image of any size.
+ * The image is converted once into a pyramid of tiles (see TiledImage), and
+ * each frame draws the tiles of the level matching the zoom that cover the
+ * window. Tiles are drawn from a fixed pool of GPU layers, filled from a
+ * fixed number of tiles kept in memory, which a reader thread fills in turn,
+ * so memory use does not grow with the image. A tile that is not resident
+ * yet is stood in for by the closest coarser tile that is; the single tile of
+ * the coarsest level stays resident throughout.
+ */
+struct TileShaderState {
+  GlProgram program;
+
+  /** Handles to uniform variables */
+  GLint h_uTiles;
+
+  /** Handles to vertex attributes */
+  GLint h_aPosition;
+  GLint h_aTexCoord;
+};
+
+static shared_ptr<TileShaderState> g_tileShaderState;
+static shared_ptr<GlBufferObject> g_tileVbo;
+static shared_ptr<TileCache> g_tileCache;
+static shared_ptr<TilePool> g_tilePool;
+
+static const int g_tileSize = 256;
+static const size_t g_tileCacheTiles = 256;     /** 48 MB of tiles in memory */
+static const int g_tileUploadsPerFrame = 8;
+static const double g_prefetchFrames = 10;      /** how far ahead of the motion tiles are read */
+
+/** Level 0 pixel at the center of the window, and window pixels per level 0 pixel */
+static double g_viewX, g_viewY, g_viewZoom;
+/** How far the view moved per frame lately, in level 0 pixels */
+static double g_viewVelocityX, g_viewVelocityY;
+static double g_lastViewX, g_lastViewY;
+
+static double fitZoom() {
+  const TiledImage& image = g_tileCache->image();
+  return min(double(g_width) / image.width(0), double(g_height) / image.height(0));
 }
 
-static void loadTexture(GLuint texHandle, const char *ppmFilename) {
-  int texWidth, texHeight;
-  vector<PackedPixel> pixData;
+static void fitView() {
+  const TiledImage& image = g_tileCache->image();
+  g_viewX = g_lastViewX = image.width(0) / 2.;
+  g_viewY = g_lastViewY = image.height(0) / 2.;
+  g_viewZoom = fitZoom();
+  g_viewVelocityX = g_viewVelocityY = 0;
+}
 
-  ppmRead(ppmFilename, texWidth, texHeight, pixData);
+/** Keeps the zoom within bounds and the image under the window center */
+static void clampView() {
+  const TiledImage& image = g_tileCache->image();
+  g_viewZoom = max(fitZoom() / 2, min(32., g_viewZoom));
+  g_viewX = max(0., min(double(image.width(0)), g_viewX));
+  g_viewY = max(0., min(double(image.height(0)), g_viewY));
+}
 
-  GLCall(glActiveTexture(GL_TEXTURE0 + texHandle));
-  GLCall(glBindTexture(GL_TEXTURE_2D, texHandle));
-  GLCall(glTexImage2D(GL_TEXTURE_2D, 0, g_Gl2Compatible ? GL_RGB : GL_SRGB, texWidth, texHeight,
-               0, GL_RGB, GL_UNSIGNED_BYTE, &pixData[0]));
-  /* glTexParameteri should be called after glTexImage2D */
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+/**
+ * The coarsest level whose pixels are no larger than a window pixel, so that
+ * tiles are shown at between half and all of their size
+ */
+static int viewLevel() {
+  const int top = g_tileCache->image().numLevels() - 1;
+  int level = 0;
+  while (level < top && g_viewZoom * (2 << level) <= 1)
+    ++level;
+  return level;
+}
+
+/** Tiles of `level' covering the window when centered on (x, y) */
+static void visibleTiles(int level, double x, double y, vector<TileKey>& tiles) {
+  const TiledImage& image = g_tileCache->image();
+  const double tileExtent = double(image.tileSize() << level);  /* in level 0 pixels */
+  const double halfWidth = g_width / (2 * g_viewZoom), halfHeight = g_height / (2 * g_viewZoom);
+  const int tx0 = max(0, int(floor((x - halfWidth) / tileExtent)));
+  const int tx1 = min(image.tilesX(level) - 1, int(floor((x + halfWidth) / tileExtent)));
+  const int ty0 = max(0, int(floor((y - halfHeight) / tileExtent)));
+  const int ty1 = min(image.tilesY(level) - 1, int(floor((y + halfHeight) / tileExtent)));
+  for (int ty = ty0; ty <= ty1; ++ty) {
+    for (int tx = tx0; tx <= tx1; ++tx) {
+      const TileKey key = { level, tx, ty };
+      tiles.push_back(key);
+    }
+  }
+}
+
+/**
+ * Appends the two triangles covering tile `key', textured from the resident
+ * tile `from' in `layer': the tile itself, or one of its coarser ancestors.
+ * Vertices are x, y in clip space, then u, v and layer.
+ */
+static void addTileQuad(vector<GLfloat>& vertices, const TileKey& key, const TileKey& from, int layer) {
+  const TiledImage& image = g_tileCache->image();
+  const int t = image.tileSize();
+
+  /* Extent of the tile in the pixels of its level, leaving out the padding */
+  const double x0 = key.x * t, x1 = min(x0 + t, double(image.width(key.level)));
+  const double y0 = key.y * t, y1 = min(y0 + t, double(image.height(key.level)));
+
+  /* The same extent in the texture coordinates of `from' */
+  const double toFrom = 1. / (1 << (from.level - key.level));
+  const double u0 = (x0 * toFrom - from.x * t) / t, u1 = (x1 * toFrom - from.x * t) / t;
+  const double v0 = (y0 * toFrom - from.y * t) / t, v1 = (y1 * toFrom - from.y * t) / t;
+
+  /* And in clip space */
+  const double scale = double(1 << key.level);
+  const double sx = 2 * g_viewZoom / g_width, sy = 2 * g_viewZoom / g_height;
+  const double cx0 = (x0 * scale - g_viewX) * sx, cx1 = (x1 * scale - g_viewX) * sx;
+  const double cy0 = (y0 * scale - g_viewY) * sy, cy1 = (y1 * scale - g_viewY) * sy;
+
+  const double corners[6][4] = {
+    { cx0, cy0, u0, v0 }, { cx1, cy0, u1, v0 }, { cx1, cy1, u1, v1 },
+    { cx0, cy0, u0, v0 }, { cx1, cy1, u1, v1 }, { cx0, cy1, u0, v1 },
+  };
+  for (int i = 0; i < 6; ++i) {
+    for (int k = 0; k < 4; ++k)
+      vertices.push_back(GLfloat(corners[i][k]));
+    vertices.push_back(GLfloat(layer));
+  }
+}
+
+/**
+ * Draws the visible tiles, uploading at most g_tileUploadsPerFrame of those
+ * that have been read, and asks the cache for the rest: first the visible
+ * tiles, then the coarser ones standing in for them, then those the view is
+ * moving towards.
+ */
+static void drawTiles() {
+  const int level = viewLevel();
+  const int top = g_tileCache->image().numLevels() - 1;
+
+  g_viewVelocityX = .5 * g_viewVelocityX + .5 * (g_viewX - g_lastViewX);
+  g_viewVelocityY = .5 * g_viewVelocityY + .5 * (g_viewY - g_lastViewY);
+  g_lastViewX = g_viewX;
+  g_lastViewY = g_viewY;
+
+  vector<TileKey> visible, wanted;
+  visibleTiles(level, g_viewX, g_viewY, visible);
+
+  g_tilePool->beginFrame();
+  vector<GLfloat> vertices;
+  int uploads = 0;
+  bool complete = true;
+  for (size_t i = 0; i < visible.size(); ++i) {
+    const TileKey& key = visible[i];
+    int layer = g_tilePool->find(key);
+    bool unreadable = false;
+    if (layer < 0) {
+      TileCache::Tile tile = uploads < g_tileUploadsPerFrame ? g_tileCache->find(key) : TileCache::Tile();
+      if (tile) {
+        layer = g_tilePool->add(key, &(*tile)[0]);
+        ++uploads;
+      }
+      else if (g_tileCache->failed(key))
+        unreadable = true;
+      else
+        wanted.push_back(key);
+    }
+
+    /* Not resident yet: stand in the closest coarser tile that is. A tile that
+     * cannot be read keeps its stand-in for good. */
+    TileKey from = key;
+    while (layer < 0 && from.level < top) {
+      from.level++;
+      from.x /= 2;
+      from.y /= 2;
+      layer = g_tilePool->find(from);
+    }
+    if (layer < 0)
+      continue;
+    if (!(from == key) && !unreadable)
+      complete = false;
+    g_tilePool->use(layer);
+    addTileQuad(vertices, key, from, layer);
+  }
+
+  const size_t numVisibleWanted = wanted.size();
+  if (level < top)
+    visibleTiles(level + 1, g_viewX, g_viewY, wanted);
+  visibleTiles(level, g_viewX + g_viewVelocityX * g_prefetchFrames, g_viewY + g_viewVelocityY * g_prefetchFrames,
+               wanted);
+  for (size_t i = numVisibleWanted; i < wanted.size();) {
+    if (g_tilePool->find(wanted[i]) >= 0)
+      wanted.erase(wanted.begin() + i);
+    else
+      ++i;
+  }
+  g_tileCache->request(wanted);
+
+  const TileShaderState& ts = *g_tileShaderState;
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glUseProgram(ts.program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, g_tilePool->texture());
+  safe_glUniform1i(ts.h_uTiles, 0);
+
+  /* All tiles in one draw, from a buffer rebuilt every frame */
+  glBindBuffer(GL_ARRAY_BUFFER, *g_tileVbo);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.empty() ? NULL : &vertices[0],
+               GL_STREAM_DRAW);
+  safe_glVertexAttribPointer(ts.h_aPosition, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), 0);
+  safe_glVertexAttribPointer(ts.h_aTexCoord, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat),
+                             reinterpret_cast<const GLvoid*>(2 * sizeof(GLfloat)));
+  safe_glEnableVertexAttribArray(ts.h_aPosition);
+  safe_glEnableVertexAttribArray(ts.h_aTexCoord);
+  glDrawArrays(GL_TRIANGLES, 0, GLsizei(vertices.size() / 5));
+  safe_glDisableVertexAttribArray(ts.h_aPosition);
+  safe_glDisableVertexAttribArray(ts.h_aTexCoord);
 
   checkGlErrors();
+
+  /* Keep drawing until the tiles being read arrive */
+  if (!complete)
+    glutPostRedisplay();
 }
 
-static void initTextures() {
-  g_tex0.reset(new GlTexture());
-  g_tex1.reset(new GlTexture());
-  g_tex2.reset(new GlTexture());
+static void tileViewerDisplay() {
+  drawTiles();
+  glutSwapBuffers();
+}
 
-  loadTexture(g_tex0->getHandle(), "smiley.ppm");
-  loadTexture(g_tex1->getHandle(), "reachup.ppm");
-  loadTexture(g_tex2->getHandle(), "shield.ppm");
+static void tileViewerMotion(int x, int y) {
+  const int newx = x;
+  const int newy = g_height - y - 1;
+  if (g_leftClicked) {
+    /* Drag the image along */
+    g_viewX -= (newx - g_leftClickX) / g_viewZoom;
+    g_viewY -= (newy - g_leftClickY) / g_viewZoom;
+    g_leftClickX = newx;
+    g_leftClickY = newy;
+  }
+  if (g_rightClicked) {
+    g_viewZoom *= exp((newx - g_rightClickX) * 0.01);
+    g_rightClickX = newx;
+    g_rightClickY = newy;
+  }
+  clampView();
+  glutPostRedisplay();
+}
+
+static void tileViewerKeyboard(unsigned char key, int x, int y) {
+  switch (key) {
+  case 'h':
+    cout << " ============== H E L P ==============\n\n"
+    << "h\t\thelp menu\n"
+    << "+/-\t\tzoom in/out\n"
+    << "r\t\tfit the image to the window\n"
+    << "q\t\tprint tile statistics and quit\n"
+    << "drag left mouse to pan\n"
+    << "drag right mouse to zoom\n";
+    break;
+  case 'q':
+    cout << "tiles read from disk: " << g_tileCache->reads()
+         << ", uploaded: " << g_tilePool->uploads() << endl;
+    exit(0);
+  case '+':
+  case '=':
+    g_viewZoom *= 1.25;
+    break;
+  case '-':
+    g_viewZoom /= 1.25;
+    break;
+  case 'r':
+    fitView();
+    break;
+  }
+  clampView();
+  glutPostRedisplay();
+}
+
+/**
+ * Opens a window onto `ppmFilename', converting it to a tiled image next to
+ * it first unless that is already up to date
+ */
+static int runTileViewer(const char *ppmFilename) {
+  const string tiledFilename = string(ppmFilename) + ".tiles";
+  if (!tiledImageUpToDate(ppmFilename, tiledFilename.c_str())) {
+    cout << "converting " << ppmFilename << " to " << tiledFilename << endl;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    convertToTiledImage(ppmFilename, tiledFilename.c_str(), g_tileSize);
+    cout << "converted in " << secondsSince(start) << " s" << endl;
+  }
+
+  initGlutState(g_argc, g_argv);
+  glutDisplayFunc(tileViewerDisplay);
+  glutMotionFunc(tileViewerMotion);
+  glutKeyboardFunc(tileViewerKeyboard);
+
+  glewInit();
+  if (g_Gl2Compatible || !GLEW_VERSION_3_0)
+    throw runtime_error("Error: the viewer needs OpenGL 3.0 array textures");
+  initGLState();
+
+  g_tileShaderState.reset(new TileShaderState);
+  TileShaderState& ts = *g_tileShaderState;
+  readAndCompileShader(ts.program, "shaders/tiles-gl3.vshader", "shaders/tiles-gl3.fshader");
+  ts.h_uTiles = safe_glGetUniformLocation(ts.program, "uTiles");
+  ts.h_aPosition = safe_glGetAttribLocation(ts.program, "aPosition");
+  ts.h_aTexCoord = safe_glGetAttribLocation(ts.program, "aTexCoord");
+  g_tileVbo.reset(new GlBufferObject());
+
+  g_tileCache.reset(new TileCache(tiledFilename.c_str(), g_tileCacheTiles));
+  const TiledImage& image = g_tileCache->image();
+
+  /* Enough layers for a screen full of tiles shown at half their size, the
+   * smallest viewLevel() shows them at, plus a quarter for stand-ins */
+  GLint maxLayers;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+  const int half = g_tileSize / 2;
+  const int screenTiles = (glutGet(GLUT_SCREEN_WIDTH) / half + 2) * (glutGet(GLUT_SCREEN_HEIGHT) / half + 2);
+  g_tilePool.reset(new TilePool(g_tileSize, min(int(maxLayers), max(64, screenTiles * 5 / 4)), GL_SRGB8));
+
+  const TileKey root = { image.numLevels() - 1, 0, 0 };
+  TileCache::Tile tile = g_tileCache->get(root);
+  if (!tile)
+    throw runtime_error("cannot read " + tiledFilename);
+  g_tilePool->add(root, &(*tile)[0], true);
+
+  cout << image.width(0) << "x" << image.height(0) << " pixels, " << image.numLevels() << " levels, "
+       << g_tilePool->numSlots() << " GPU tiles, " << g_tileCacheTiles << " tiles in memory" << endl;
+  fitView();
+  glutMainLoop();
+  return 0;
 }
 
 /* M A I N ************************************************************/
@@ -569,7 +2638,31 @@ static void initTextures() {
  * The main entry-point for the HelloWorld example application.
  */
 int main(int argc, char **argv) {
+  g_argc = argc;
+  g_argv = argv;
+
   try {
+    /* --view image.ppm: pan and zoom over an image of any size */
+    if (argc > 2 && string(argv[1]) == "--view")
+      return runTileViewer(argv[2]);
+
+    /* --upload-bench [iterations]: compare texture upload paths and exit */
+    if (argc > 1 && string(argv[1]) == "--upload-bench")
+      return runUploadBenchmark(argc > 2 ? atoi(argv[2]) : 100);
+
+    /* --farm [workers] [frames]: render headless on several processes. This
+     * must happen before GLUT is initialized here, as workers fork from us. */
+    if (argc > 1 && string(argv[1]) == "--farm") {
+      const int numWorkers = argc > 2 ? atoi(argv[2]) : farmDefaultWorkerCount();
+      const int numFrames = argc > 3 ? atoi(argv[3]) : 64;
+      return runFarmMode(numWorkers, numFrames);
+    }
+
+    /* --obj mesh.obj: draw the faces of an OBJ file instead of the triangle */
+    if (argc > 2 && string(argv[1]) == "--obj")
+      g_objFilename = argv[2];
+
+    TextureUploader::initThreading();
     initGlutState(argc,argv);
 
     glewInit(); // load the OpenGL extensions
@@ -581,9 +2674,34 @@ int main(int argc, char **argv) {
       throw runtime_error("Error: card/driver does not support OpenGL Shading Language v1.0");
 
     initGLState();
+
+    /* Textures load in the background while the first frames are drawn */
+    if (TextureUploader::supported()) {
+      try {
+        g_uploader.reset(new TextureUploader());
+      }
+      catch (const runtime_error& e) {
+        cerr << "WARN: " << e.what() << ", loading textures synchronously" << endl;
+      }
+    }
+
     initShaders();
     initGeometry();
+    g_streamBuffer.reset(new StreamBuffer(g_streamBufferBytes));
     initTextures();
+    initAtlas();
+    initTextureArray();
+    initFlipbook();
+
+    uploadAsync(printUploadStats);
+
+    /* Saving an image or shader reloads it in the running program */
+    try {
+      initFileWatcher();
+    }
+    catch (const runtime_error& e) {
+      cerr << "WARN: " << e.what() << ", files will not be reloaded" << endl;
+    }
 
     glutMainLoop();
     return 0;
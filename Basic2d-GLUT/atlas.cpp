@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "atlas.h"
+
+using namespace std;
+
+// Bottom-left skyline packer for a single page. The skyline is the list of
+// horizontal segments forming the top edge of everything placed so far;
+// a rectangle goes on the spot where its bottom would be lowest.
+class SkylinePacker {
+  struct Segment {
+    int x, y, width;
+  };
+
+  int width_, height_;
+  vector<Segment> skyline_;
+
+  // Height at which a w x h rectangle whose left edge is at segment i would
+  // rest, or -1 if it does not fit there
+  int fit(size_t i, int w, int h) const {
+    if (skyline_[i].x + w > width_)
+      return -1;
+    int y = 0;
+    for (int remaining = w; remaining > 0; ++i) {
+      y = max(y, skyline_[i].y);
+      if (y + h > height_)
+        return -1;
+      remaining -= skyline_[i].width;
+    }
+    return y;
+  }
+
+public:
+  SkylinePacker(int width, int height) : width_(width), height_(height) {
+    Segment s = { 0, 0, width };
+    skyline_.push_back(s);
+  }
+
+  // Places a w x h rectangle, returning false if there is no room left
+  bool insert(int w, int h, int& outX, int& outY) {
+    int best = -1, bestY = height_;
+    for (size_t i = 0; i < skyline_.size(); ++i) {
+      const int y = fit(i, w, h);
+      if (y >= 0 && y < bestY) {
+        best = i;
+        bestY = y;
+      }
+    }
+    if (best < 0)
+      return false;
+
+    outX = skyline_[best].x;
+    outY = bestY;
+
+    // Raise the skyline under the new rectangle, cutting away the segments it
+    // covers, then merge neighbours of equal height
+    Segment s = { outX, bestY + h, w };
+    skyline_.insert(skyline_.begin() + best, s);
+    for (size_t i = best + 1; i < skyline_.size(); ) {
+      const int overlap = outX + w - skyline_[i].x;
+      if (overlap <= 0)
+        break;
+      skyline_[i].x += overlap;
+      skyline_[i].width -= overlap;
+      if (skyline_[i].width > 0)
+        break;
+      skyline_.erase(skyline_.begin() + i);
+    }
+    for (size_t i = 0; i + 1 < skyline_.size(); ) {
+      if (skyline_[i].y == skyline_[i + 1].y) {
+        skyline_[i].width += skyline_[i + 1].width;
+        skyline_.erase(skyline_.begin() + i + 1);
+      }
+      else
+        ++i;
+    }
+    return true;
+  }
+
+  int usedHeight() const {
+    int h = 0;
+    for (size_t i = 0; i < skyline_.size(); ++i)
+      h = max(h, skyline_[i].y);
+    return h;
+  }
+};
+
+TextureAtlas::TextureAtlas(int pageSize, int padding)
+  : pageSize_(pageSize), padding_(padding) {}
+
+int TextureAtlas::add(int width, int height, const PackedPixel *pixels) {
+  images_.push_back(Image());
+  Image& img = images_.back();
+  img.width = width;
+  img.height = height;
+  img.pixels.assign(pixels, pixels + width * height);
+  return images_.size() - 1;
+}
+
+// Orders images by decreasing height, then width: packing tall images first
+// leaves a flatter skyline
+struct ByDecreasingSize {
+  const vector<int> *heights, *widths;
+
+  bool operator() (int a, int b) const {
+    if ((*heights)[a] != (*heights)[b])
+      return (*heights)[a] > (*heights)[b];
+    return (*widths)[a] > (*widths)[b];
+  }
+};
+
+void TextureAtlas::pack() {
+  const int n = images_.size();
+  vector<int> order(n), heights(n), widths(n);
+  for (int i = 0; i < n; ++i) {
+    order[i] = i;
+    heights[i] = images_[i].height;
+    widths[i] = images_[i].width;
+  }
+  ByDecreasingSize cmp = { &heights, &widths };
+  stable_sort(order.begin(), order.end(), cmp);
+
+  vector<SkylinePacker> packers;
+  regions_.assign(n, AtlasRegion());
+  for (int k = 0; k < n; ++k) {
+    const int i = order[k];
+    const int w = images_[i].width + 2 * padding_, h = images_[i].height + 2 * padding_;
+    if (w > pageSize_ || h > pageSize_)
+      throw runtime_error("TextureAtlas: image does not fit in a page");
+
+    int page = 0, x = 0, y = 0;
+    while (page < int(packers.size()) && !packers[page].insert(w, h, x, y))
+      ++page;
+    if (page == int(packers.size())) {
+      packers.push_back(SkylinePacker(pageSize_, pageSize_));
+      packers.back().insert(w, h, x, y);
+    }
+
+    AtlasRegion& r = regions_[i];
+    r.page = page;
+    r.x = x + padding_;
+    r.y = y + padding_;
+    r.width = images_[i].width;
+    r.height = images_[i].height;
+  }
+
+  pages_.assign(packers.size(), Page());
+  for (size_t p = 0; p < pages_.size(); ++p) {
+    pages_[p].width = pageSize_;
+    pages_[p].height = packers[p].usedHeight();
+    pages_[p].pixels.assign(size_t(pages_[p].width) * pages_[p].height, PackedPixel());
+  }
+
+  for (int i = 0; i < n; ++i) {
+    AtlasRegion& r = regions_[i];
+    const Page& pg = pages_[r.page];
+    r.u0 = float(r.x) / pg.width;
+    r.v0 = float(r.y) / pg.height;
+    r.u1 = float(r.x + r.width) / pg.width;
+    r.v1 = float(r.y + r.height) / pg.height;
+    blit(images_[i], r);
+  }
+}
+
+void TextureAtlas::blit(const Image& img, const AtlasRegion& r) {
+  Page& pg = pages_[r.page];
+  for (int y = -padding_; y < img.height + padding_; ++y) {
+    const int sy = min(max(y, 0), img.height - 1);
+    PackedPixel *dst = &pg.pixels[size_t(r.y + y) * pg.width + r.x];
+    const PackedPixel *src = &img.pixels[size_t(sy) * img.width];
+    for (int x = -padding_; x < img.width + padding_; ++x)
+      dst[x] = src[min(max(x, 0), img.width - 1)];
+  }
+}
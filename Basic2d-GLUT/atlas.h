@@ -0,0 +1,69 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <vector>
+
+#include "ppm.h"
+
+// Where an image ended up in an atlas: the page it is on, its pixel rectangle
+// on that page, and the same rectangle in texture coordinates.
+struct AtlasRegion {
+  int page;
+  int x, y, width, height;
+  float u0, v0, u1, v1;
+};
+
+// Packs many small images into a few large pages, so that they can all be
+// sampled from one texture. Every image is surrounded by `padding' pixels
+// replicating its edge, so that filtering near the border of a region never
+// picks up a neighbour.
+class TextureAtlas {
+public:
+  struct Page {
+    int width, height;
+    std::vector<PackedPixel> pixels;
+  };
+
+private:
+  struct Image {
+    int width, height;
+    std::vector<PackedPixel> pixels;
+  };
+
+  int pageSize_, padding_;
+  std::vector<Image> images_;
+  std::vector<AtlasRegion> regions_;
+  std::vector<Page> pages_;
+
+  TextureAtlas(const TextureAtlas&);
+  const TextureAtlas& operator= (const TextureAtlas&);
+
+  void blit(const Image& img, const AtlasRegion& r);
+
+public:
+  // Pages are at most `pageSize' pixels wide and high
+  TextureAtlas(int pageSize, int padding);
+
+  // Queues an image for packing and returns its index. The pixels are copied.
+  int add(int width, int height, const PackedPixel *pixels);
+
+  // Packs all queued images, largest first, with a skyline packer, opening a
+  // new page whenever the current ones are full. The height of each page is
+  // trimmed to what is used. Throws runtime_error if an image does not fit in
+  // an empty page.
+  void pack();
+
+  int numPages() const {
+    return pages_.size();
+  }
+
+  const Page& page(int i) const {
+    return pages_[i];
+  }
+
+  const AtlasRegion& region(int image) const {
+    return regions_[image];
+  }
+};
+
+#endif
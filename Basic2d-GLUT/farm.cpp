@@ -0,0 +1,264 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#ifndef _WIN32
+# include <sys/mman.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+#include "farm.h"
+
+using namespace std;
+
+enum { FARM_PENDING = 0, FARM_DONE = 1, FARM_FAILED = 2 };
+
+// Throughput counters of a single worker, kept in memory shared with the parent
+struct FarmWorkerStats {
+  int pid;
+  int framesRendered;
+  int framesStolen;
+  double seconds;
+};
+
+// Per-worker job queue: a range [head, tail) of job indices packed into a
+// single 64-bit word, so the owner popping from the front and thieves taking
+// from the back can both update it with one compare-and-swap.
+typedef atomic<uint64_t> FarmRange;
+
+static uint64_t packRange(uint32_t head, uint32_t tail) {
+  return (uint64_t(tail) << 32) | head;
+}
+
+static int popFront(FarmRange& range) {
+  uint64_t v = range.load();
+  for (;;) {
+    const uint32_t head = uint32_t(v), tail = uint32_t(v >> 32);
+    if (head >= tail)
+      return -1;
+    if (range.compare_exchange_weak(v, packRange(head + 1, tail)))
+      return head;
+  }
+}
+
+static int stealBack(FarmRange *ranges, int numWorkers, int thief) {
+  for (;;) {
+    int victim = -1;
+    uint32_t most = 0;
+    for (int w = 0; w < numWorkers; ++w) {
+      const uint64_t v = ranges[w].load();
+      const uint32_t head = uint32_t(v), tail = uint32_t(v >> 32);
+      if (w != thief && tail > head && tail - head > most) {
+        most = tail - head;
+        victim = w;
+      }
+    }
+    if (victim < 0)
+      return -1;
+
+    uint64_t v = ranges[victim].load();
+    const uint32_t head = uint32_t(v), tail = uint32_t(v >> 32);
+    if (head < tail && ranges[victim].compare_exchange_strong(v, packRange(head, tail - 1)))
+      return tail - 1;
+  }
+}
+
+static string farmOutputName(const char *outPrefix, int frame) {
+  char buf[32];
+  sprintf(buf, "-%05d.ppm", frame);
+  return string(outPrefix) + buf;
+}
+
+static double secondsSince(const chrono::steady_clock::time_point& start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Renders job `j' and records whether it succeeded
+static void farmRenderOne(int self, int j, unsigned char *status, const vector<FarmJob>& jobs,
+                          const char *outPrefix, FarmRenderFunc render) {
+  try {
+    render(jobs[j], farmOutputName(outPrefix, jobs[j].frame).c_str());
+    status[j] = FARM_DONE;
+  }
+  catch (const exception& e) {
+    cerr << "farm worker " << self << ": frame " << jobs[j].frame << ": " << e.what() << endl;
+    status[j] = FARM_FAILED;
+  }
+}
+
+// Takes jobs from the worker's own range, then steals, until no job is left
+static void farmWorkerLoop(int self, int numWorkers, FarmRange *ranges,
+                           FarmWorkerStats& stats, unsigned char *status,
+                           const vector<FarmJob>& jobs, const char *outPrefix,
+                           FarmRenderFunc render) {
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (;;) {
+    bool stolen = false;
+    int j = popFront(ranges[self]);
+    if (j < 0) {
+      j = stealBack(ranges, numWorkers, self);
+      stolen = true;
+    }
+    if (j < 0)
+      break;
+
+    farmRenderOne(self, j, status, jobs, outPrefix, render);
+    ++stats.framesRendered;
+    if (stolen)
+      ++stats.framesStolen;
+  }
+  stats.seconds = secondsSince(start);
+}
+
+static void printFarmReport(const vector<FarmWorkerStats>& stats, int numJobs, double seconds) {
+  const int numWorkers = stats.size();
+  for (int w = 0; w < numWorkers; ++w) {
+    const FarmWorkerStats& s = stats[w];
+    printf("worker %2d (pid %6d): %5d frames (%4d stolen) in %7.3fs, %8.2f fps\n",
+           w, s.pid, s.framesRendered, s.framesStolen, s.seconds,
+           s.seconds > 0 ? s.framesRendered / s.seconds : 0.0);
+  }
+  printf("farm: %d frames on %d workers in %.3fs, %.2f fps\n",
+         numJobs, numWorkers, seconds, seconds > 0 ? numJobs / seconds : 0.0);
+}
+
+int farmDefaultWorkerCount() {
+  const int n = thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+vector<string> runRenderFarm(const vector<FarmJob>& jobs, int numWorkers,
+                             const char *outPrefix,
+                             FarmInitFunc init, FarmRenderFunc render,
+                             FarmFinishFunc finish) {
+  const int numJobs = jobs.size();
+  if (numWorkers < 1)
+    numWorkers = 1;
+  if (numWorkers > numJobs)
+    numWorkers = numJobs > 0 ? numJobs : 1;
+
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<string> outputs(numJobs);
+
+#ifdef _WIN32
+  // No fork(): render everything in this process as a single worker
+  numWorkers = 1;
+  FarmRange ranges[1];
+  ranges[0] = packRange(0, numJobs);
+  vector<FarmWorkerStats> report(1);
+  report[0].pid = report[0].framesRendered = report[0].framesStolen = 0;
+  report[0].seconds = 0.0;
+  vector<unsigned char> status(numJobs, FARM_PENDING);
+
+  init(0);
+  farmWorkerLoop(0, 1, ranges, report[0], &status[0], jobs, outPrefix, render);
+  if (finish)
+    finish(0);
+#else
+  // Queues, counters and per-job status live in an anonymous shared mapping so
+  // that the forked workers and the parent all see the same memory
+  const size_t bytes = numWorkers * (sizeof(FarmRange) + sizeof(FarmWorkerStats)) + numJobs;
+  void *shared = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED)
+    throw runtime_error("runRenderFarm: cannot map shared memory");
+
+  FarmRange *ranges = static_cast<FarmRange*>(shared);
+  FarmWorkerStats *stats = reinterpret_cast<FarmWorkerStats*>(ranges + numWorkers);
+  unsigned char *status = reinterpret_cast<unsigned char*>(stats + numWorkers);
+  memset(status, FARM_PENDING, numJobs);
+
+  for (int w = 0; w < numWorkers; ++w) {
+    new (&ranges[w]) FarmRange(packRange(numJobs * w / numWorkers, numJobs * (w + 1) / numWorkers));
+    stats[w].pid = 0;
+    stats[w].framesRendered = stats[w].framesStolen = 0;
+    stats[w].seconds = 0.0;
+  }
+
+  vector<pid_t> pids;
+  for (int w = 0; w < numWorkers; ++w) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+      cerr << "runRenderFarm: fork failed, continuing with " << w << " workers" << endl;
+      break;
+    }
+    if (pid == 0) {
+      // A worker that fails to set up its context takes no jobs; the others
+      // steal its range
+      int rc = 0;
+      stats[w].pid = getpid();
+      try {
+        init(w);
+        farmWorkerLoop(w, numWorkers, ranges, stats[w], status, jobs, outPrefix, render);
+        if (finish)
+          finish(w);
+      }
+      catch (const exception& e) {
+        cerr << "farm worker " << w << ": " << e.what() << endl;
+        rc = 1;
+      }
+      fflush(NULL);
+      _exit(rc);
+    }
+    pids.push_back(pid);
+  }
+  for (size_t i = 0; i < pids.size(); ++i)
+    waitpid(pids[i], NULL, 0);
+  vector<FarmWorkerStats> report(stats, stats + pids.size());
+
+  // Jobs still pending had no worker left to take them: none could be
+  // forked, or the last ones running failed to set up. The parent renders
+  // them itself, as without fork().
+  vector<int> leftover;
+  for (int j = 0; j < numJobs; ++j) {
+    if (status[j] == FARM_PENDING)
+      leftover.push_back(j);
+  }
+  if (!leftover.empty()) {
+    const int self = pids.size();
+    FarmWorkerStats parent = { int(getpid()), 0, 0, 0.0 };
+    const chrono::steady_clock::time_point parentStart = chrono::steady_clock::now();
+    try {
+      init(self);
+      for (size_t i = 0; i < leftover.size(); ++i) {
+        farmRenderOne(self, leftover[i], status, jobs, outPrefix, render);
+        ++parent.framesRendered;
+      }
+      if (finish)
+        finish(self);
+    }
+    catch (const exception& e) {
+      cerr << "farm worker " << self << ": " << e.what() << endl;
+    }
+    parent.seconds = secondsSince(parentStart);
+    report.push_back(parent);
+  }
+#endif
+
+  int failed = 0;
+  for (int j = 0; j < numJobs; ++j) {
+    if (status[j] == FARM_DONE)
+      outputs[j] = farmOutputName(outPrefix, jobs[j].frame);
+    else
+      ++failed;
+  }
+
+  printFarmReport(report, numJobs, secondsSince(start));
+  if (failed > 0)
+    cerr << "farm: " << failed << " of " << numJobs << " frames were not rendered" << endl;
+
+#ifndef _WIN32
+  for (int w = 0; w < numWorkers; ++w)
+    ranges[w].~FarmRange();
+  munmap(shared, bytes);
+#endif
+  return outputs;
+}
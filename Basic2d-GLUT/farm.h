@@ -0,0 +1,41 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include <string>
+#include <vector>
+
+// One unit of work handed out to a render farm worker: the frame number used
+// to name the output, and the scene parameters to render it with.
+struct FarmJob {
+  int frame;
+  int xOffset, yOffset;
+  float objScale;
+};
+
+// Called once inside each freshly started worker, before it takes any job.
+// This is where the worker creates its own GL context. Throws on error.
+typedef void (*FarmInitFunc)(int workerIndex);
+
+// Renders a single job and writes the resulting image to `outFilename'.
+// Throws runtime_error on error.
+typedef void (*FarmRenderFunc)(const FarmJob& job, const char *outFilename);
+
+// Called inside each worker once it has run out of jobs
+typedef void (*FarmFinishFunc)(int workerIndex);
+
+// Number of workers to use when none is given: one per online CPU core.
+int farmDefaultWorkerCount();
+
+// Renders `jobs' with `numWorkers' forked worker processes. Jobs are split into
+// one contiguous range per worker; a worker that runs out of jobs steals from
+// the back of the fullest remaining range. `finish' may be NULL. Prints
+// per-worker throughput when done and returns the output file names in job
+// order (an empty string marks a job that failed). On platforms without fork()
+// the jobs run in-process, and so do any jobs no forked worker got to, with
+// the parent as one more worker.
+std::vector<std::string> runRenderFarm(const std::vector<FarmJob>& jobs, int numWorkers,
+                                       const char *outPrefix,
+                                       FarmInitFunc init, FarmRenderFunc render,
+                                       FarmFinishFunc finish);
+
+#endif
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+# include <sys/inotify.h>
+# include <unistd.h>
+#endif
+
+#include "filewatch.h"
+
+using namespace std;
+
+#ifdef __linux__
+static string directoryOf(const string& path) {
+  const size_t slash = path.find_last_of("/\\");
+  return slash == string::npos ? string(".") : path.substr(0, slash);
+}
+#else
+static pair<long long, long long> stampOf(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return make_pair(-1LL, -1LL);
+  return make_pair(static_cast<long long>(st.st_mtime), static_cast<long long>(st.st_size));
+}
+#endif
+
+FileWatcher::FileWatcher() : fd_(-1) {
+#ifdef __linux__
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0)
+    throw runtime_error("FileWatcher: inotify_init1 failed");
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+  close(fd_);
+#endif
+}
+
+void FileWatcher::watch(const string& path) {
+  files_.insert(path);
+#ifdef __linux__
+  const string dir = directoryOf(path);
+  for (map<int, string>::const_iterator i = dirs_.begin(); i != dirs_.end(); ++i) {
+    if (i->second == dir)
+      return;
+  }
+  const int wd = inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd < 0)
+    throw runtime_error("FileWatcher: cannot watch " + dir);
+  dirs_[wd] = dir;
+#else
+  stamps_[path] = stampOf(path);
+#endif
+}
+
+void FileWatcher::poll(vector<string>& changed) {
+  const size_t first = changed.size();
+#ifdef __linux__
+  char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+  for (;;) {
+    const ssize_t len = read(fd_, buf, sizeof(buf));
+    if (len <= 0)
+      break;
+    for (const char *p = buf; p < buf + len; p += sizeof(inotify_event) + reinterpret_cast<const inotify_event*>(p)->len) {
+      const inotify_event *e = reinterpret_cast<const inotify_event*>(p);
+      map<int, string>::const_iterator dir = dirs_.find(e->wd);
+      if (dir == dirs_.end() || e->len == 0)
+        continue;
+      const string path = dir->second == "." ? string(e->name) : dir->second + "/" + e->name;
+      if (files_.count(path))
+        changed.push_back(path);
+    }
+  }
+#else
+  for (map<string, pair<long long, long long> >::iterator i = stamps_.begin(); i != stamps_.end(); ++i) {
+    const pair<long long, long long> stamp = stampOf(i->first);
+    if (stamp != i->second) {
+      i->second = stamp;
+      changed.push_back(i->first);
+    }
+  }
+#endif
+
+  // An editor may write a file several times in a row
+  sort(changed.begin() + first, changed.end());
+  changed.erase(unique(changed.begin() + first, changed.end()), changed.end());
+}
@@ -0,0 +1,35 @@
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Reports which of a set of files have been written to. On Linux this is
+// driven by inotify, watching the directories of the files so that editors
+// that save by renaming a new file over the old one are caught too. Elsewhere
+// the files' modification times and sizes are compared on every poll.
+class FileWatcher {
+  int fd_;
+  std::map<int, std::string> dirs_;                          // inotify watch -> directory
+  std::set<std::string> files_;
+  std::map<std::string, std::pair<long long, long long> > stamps_;  // file -> mtime, size
+
+  FileWatcher(const FileWatcher&);
+  const FileWatcher& operator= (const FileWatcher&);
+
+public:
+  FileWatcher();
+  ~FileWatcher();
+
+  // Starts watching `path'. Throws runtime_error if its directory cannot be
+  // watched.
+  void watch(const std::string& path);
+
+  // Appends the watched files changed since the last call to `changed', each
+  // once, in the form they were passed to watch(). Never blocks.
+  void poll(std::vector<std::string>& changed);
+};
+
+#endif
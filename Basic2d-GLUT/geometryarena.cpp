@@ -0,0 +1,80 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "geometryarena.h"
+
+using namespace std;
+
+GeometryArena::GeometryArena(const VertexFormat& format, GLuint maxVertices, GLuint maxIndices,
+                             StreamBuffer *stream)
+  : stream_(stream), format_(format), maxVertices_(maxVertices), maxIndices_(maxIndices), numVertices_(0),
+    numIndices_(0), submits_(0) {
+  vbo_.data(GLsizeiptr(maxVertices_) * format_.stride, NULL, GL_STATIC_DRAW);
+  indexVbo_.data(GLsizeiptr(maxIndices_) * sizeof(GLushort), NULL, GL_STATIC_DRAW);
+
+  glBindVertexArray(vao_);
+  setVertexAttributes(format_, vbo_);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVbo_);
+  glBindVertexArray(0);
+  checkGlErrors();
+}
+
+bool GeometryArena::supported() {
+  return GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+}
+
+int GeometryArena::add(const void *vertices, GLuint numVertices, const GLushort *indices, GLuint numIndices) {
+  if (numVertices > 65536)
+    throw runtime_error("GeometryArena: a mesh has more vertices than 16-bit indices reach");
+  if (numVertices > maxVertices_ - numVertices_ || numIndices > maxIndices_ - numIndices_)
+    throw runtime_error("GeometryArena: the arena is full");
+
+  vbo_.subData(GLintptr(numVertices_) * format_.stride, GLsizeiptr(numVertices) * format_.stride, vertices);
+  indexVbo_.subData(GLintptr(numIndices_) * sizeof(GLushort), GLsizeiptr(numIndices) * sizeof(GLushort), indices);
+  checkGlErrors();
+
+  const Mesh m = { numIndices_, numIndices, GLint(numVertices_) };
+  meshes_.push_back(m);
+  numVertices_ += numVertices;
+  numIndices_ += numIndices;
+  return int(meshes_.size()) - 1;
+}
+
+int GeometryArena::draw(int id, GLuint numInstances) {
+  const Mesh& m = meshes_[id];
+  const DrawCommand c = { m.numIndices, numInstances, m.firstIndex, m.baseVertex, 0 };
+  commands_.push_back(c);
+  return int(commands_.size()) - 1;
+}
+
+int GeometryArena::submit(GLenum mode) {
+  if (commands_.empty())
+    return 0;
+
+  // The commands are read from a buffer, like vertices. The arena's own one
+  // is orphaned on every submit, so the GPU may still read the last ones.
+  const size_t bytes = commands_.size() * sizeof(DrawCommand);
+  GLuint buffer;
+  size_t offset = 0;
+  if (stream_) {
+    memcpy(stream_->allocate(bytes, sizeof(GLuint), offset), &commands_[0], bytes);
+    stream_->commit();
+    buffer = stream_->buffer();
+  }
+  else {
+    commandVbo_.data(bytes, &commands_[0], GL_STREAM_DRAW);
+    buffer = commandVbo_;
+  }
+
+  glBindVertexArray(vao_);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+  glMultiDrawElementsIndirect(mode, GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid*>(offset),
+                              GLsizei(commands_.size()), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindVertexArray(0);
+  checkGlErrors();
+
+  commands_.clear();
+  ++submits_;
+  return 1;
+}
@@ -0,0 +1,83 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <vector>
+
+#include "glsupport.h"
+#include "streambuffer.h"
+#include "vertexformat.h"
+
+// Many meshes sharing one vertex buffer and one index buffer, so that any mix
+// of them is drawn with a single glMultiDrawElementsIndirect. Each draw
+// queued with draw() becomes one DrawElementsIndirectCommand; submit() writes
+// them all to a command buffer and issues them at once. Shaders tell the
+// draws apart by gl_DrawID (GL 4.6 / ARB_shader_draw_parameters), which
+// counts them in the order they were queued. Needs GL 4.3 or
+// ARB_multi_draw_indirect.
+class GeometryArena : Noncopyable {
+public:
+  // Where a mesh lies in the shared buffers
+  struct Mesh {
+    GLuint firstIndex, numIndices;
+    GLint baseVertex;
+  };
+
+private:
+  // Layout read by glMultiDrawElementsIndirect
+  struct DrawCommand {
+    GLuint count, instanceCount, firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+  };
+
+  GlBufferObject vbo_, indexVbo_, commandVbo_;
+  GlVertexArray vao_;
+  StreamBuffer *stream_;
+  VertexFormat format_;
+  GLuint maxVertices_, maxIndices_, numVertices_, numIndices_;
+  std::vector<Mesh> meshes_;
+  std::vector<DrawCommand> commands_;
+  long submits_;
+
+public:
+  // Holds up to `maxVertices' vertices in `format', whose attributes must
+  // outlive the arena, and `maxIndices' 16-bit indices. Command buffers are
+  // allocated from `stream' if given, which must then outlive the arena, and
+  // be between its beginFrame() and endFrame() when submitting.
+  GeometryArena(const VertexFormat& format, GLuint maxVertices, GLuint maxIndices, StreamBuffer *stream = NULL);
+
+  static bool supported();
+
+  // Copies a mesh into the arena and returns its id. Indices are relative to
+  // the mesh's first vertex, so a mesh has at most 65536 vertices. Throws
+  // runtime_error if the arena is full.
+  int add(const void *vertices, GLuint numVertices, const GLushort *indices, GLuint numIndices);
+
+  const Mesh& mesh(int id) const {
+    return meshes_[id];
+  }
+
+  int numMeshes() const {
+    return int(meshes_.size());
+  }
+
+  // Queues `numInstances' instances of mesh `id' as the next draw, and
+  // returns its gl_DrawID
+  int draw(int id, GLuint numInstances = 1);
+
+  // Number of draws queued since the last submit
+  int size() const {
+    return int(commands_.size());
+  }
+
+  // Issues the queued draws as `mode' primitives with one call, and returns
+  // the number of calls made: 1, or 0 if nothing was queued
+  int submit(GLenum mode);
+
+  // Number of calls made by submit() so far
+  long submits() const {
+    return submits_;
+  }
+};
+
+#endif
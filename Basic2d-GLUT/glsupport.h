@@ -47,6 +47,18 @@ void readAndCompileSingleShaderFromMemory(GLuint shaderHandle,
                                           int sourceLength, const char *source);
 
 
+// Whether objects can be created and edited without binding them (GL 4.5 or
+// ARB_direct_state_access). The wrappers below fall back to binding them
+// when not.
+inline bool glHasDirectStateAccess() {
+  return GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access;
+}
+
+// Whether program uniforms can be set without the program being in use
+inline bool glHasProgramUniforms() {
+  return GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects;
+}
+
 // Classes inheriting Noncopyable will not have default compiler generated copy
 // constructor and assignment operator
 class Noncopyable {
@@ -104,17 +116,106 @@ public:
   operator GLuint() const {
     return handle_;
   }
+
+  // Set uniform `location' of this program whether or not it is in use. With
+  // no glProgramUniform*, the program is made current for the call and the
+  // previous one restored. Locations of -1 are ignored, as with
+  // safe_glUniform1i.
+  void uniform1i(GLint location, GLint a) const {
+    if (location < 0)
+      return;
+    if (glHasProgramUniforms()) {
+      glProgramUniform1i(handle_, location, a);
+      return;
+    }
+    const GLint previous = use();
+    glUniform1i(location, a);
+    glUseProgram(previous);
+  }
+
+  void uniform1f(GLint location, GLfloat a) const {
+    if (location < 0)
+      return;
+    if (glHasProgramUniforms()) {
+      glProgramUniform1f(handle_, location, a);
+      return;
+    }
+    const GLint previous = use();
+    glUniform1f(location, a);
+    glUseProgram(previous);
+  }
+
+  void uniform4f(GLint location, GLfloat a, GLfloat b, GLfloat c, GLfloat d) const {
+    if (location < 0)
+      return;
+    if (glHasProgramUniforms()) {
+      glProgramUniform4f(handle_, location, a, b, c, d);
+      return;
+    }
+    const GLint previous = use();
+    glUniform4f(location, a, b, c, d);
+    glUseProgram(previous);
+  }
+
+private:
+  // Makes the program current and returns the one that was
+  GLint use() const {
+    GLint previous;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(handle_);
+    return previous;
+  }
 };
 
 
 // Light wrapper around a GL texture object handle that automatically allocates
 // and deallocates. Can be casted to a GLuint.
+//
+// A texture constructed with its target can be allocated and filled through
+// the methods below, which use direct state access when the context has it.
+// Otherwise they bind the texture on the active unit for the call and then
+// bind back whatever was bound there.
 class GlTexture : Noncopyable {
 protected:
     GLuint handle_;
+    GLenum target_;
+
+    // Query for the texture bound to `target', or 0 for targets not listed
+    static GLenum bindingQuery(GLenum target) {
+        switch (target) {
+        case GL_TEXTURE_1D: return GL_TEXTURE_BINDING_1D;
+        case GL_TEXTURE_2D: return GL_TEXTURE_BINDING_2D;
+        case GL_TEXTURE_3D: return GL_TEXTURE_BINDING_3D;
+        case GL_TEXTURE_1D_ARRAY: return GL_TEXTURE_BINDING_1D_ARRAY;
+        case GL_TEXTURE_2D_ARRAY: return GL_TEXTURE_BINDING_2D_ARRAY;
+        case GL_TEXTURE_CUBE_MAP: return GL_TEXTURE_BINDING_CUBE_MAP;
+        case GL_TEXTURE_RECTANGLE: return GL_TEXTURE_BINDING_RECTANGLE;
+        default: return 0;
+        }
+    }
+
+    // Binds the texture on the active unit while in scope
+    class EditBinding : Noncopyable {
+        GLenum target_;
+        GLint previous_;
+
+    public:
+        explicit EditBinding(const GlTexture& texture) : target_(texture.target_), previous_(0) {
+            const GLenum query = bindingQuery(target_);
+            if (query)
+                glGetIntegerv(query, &previous_);
+            glBindTexture(target_, texture.handle_);
+        }
+
+        ~EditBinding() {
+            glBindTexture(target_, previous_);
+        }
+    };
 
 public:
-    GlTexture() {
+    // A texture name only; it becomes a texture of the target it is first
+    // bound to
+    GlTexture() : target_(0) {
         GLCall(glGenTextures(1, &handle_));
         if (handle_ == 0) {
             throw std::runtime_error("glGenTextures failed to generate texture.");
@@ -122,6 +223,126 @@ public:
         checkGlErrors();
     }
 
+    // A texture of `target', created without being bound when the context
+    // has direct state access
+    explicit GlTexture(GLenum target) : target_(target) {
+        if (glHasDirectStateAccess()) {
+            GLCall(glCreateTextures(target, 1, &handle_));
+        }
+        else {
+            GLCall(glGenTextures(1, &handle_));
+        }
+        if (handle_ == 0) {
+            throw std::runtime_error("glGenTextures failed to generate texture.");
+        }
+        checkGlErrors();
+    }
+
+    GLenum target() const {
+        return target_;
+    }
+
+    // Allocates `levels' mip levels of `internalFormat', immutable where
+    // texture storage is available
+    void storage2D(GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height) const {
+        if (glHasDirectStateAccess()) {
+            glTextureStorage2D(handle_, levels, internalFormat, width, height);
+            return;
+        }
+        EditBinding binding(*this);
+        if (GLEW_VERSION_4_2 || GLEW_ARB_texture_storage) {
+            glTexStorage2D(target_, levels, internalFormat, width, height);
+            return;
+        }
+        for (GLsizei l = 0; l < levels; ++l) {
+            glTexImage2D(target_, l, internalFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+        glTexParameteri(target_, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+
+    void storage3D(GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth) const {
+        if (glHasDirectStateAccess()) {
+            glTextureStorage3D(handle_, levels, internalFormat, width, height, depth);
+            return;
+        }
+        EditBinding binding(*this);
+        if (GLEW_VERSION_4_2 || GLEW_ARB_texture_storage) {
+            glTexStorage3D(target_, levels, internalFormat, width, height, depth);
+            return;
+        }
+        // Array layers are not halved with the levels
+        const bool array = target_ == GL_TEXTURE_2D_ARRAY;
+        for (GLsizei l = 0; l < levels; ++l) {
+            glTexImage3D(target_, l, internalFormat, width, height, depth, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+            depth = array || depth == 1 ? depth : depth / 2;
+        }
+        glTexParameteri(target_, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+
+    void subImage2D(GLint level, GLint x, GLint y, GLsizei width, GLsizei height,
+                    GLenum format, GLenum type, const void *pixels) const {
+        if (glHasDirectStateAccess()) {
+            glTextureSubImage2D(handle_, level, x, y, width, height, format, type, pixels);
+            return;
+        }
+        EditBinding binding(*this);
+        glTexSubImage2D(target_, level, x, y, width, height, format, type, pixels);
+    }
+
+    void subImage3D(GLint level, GLint x, GLint y, GLint z, GLsizei width, GLsizei height, GLsizei depth,
+                    GLenum format, GLenum type, const void *pixels) const {
+        if (glHasDirectStateAccess()) {
+            glTextureSubImage3D(handle_, level, x, y, z, width, height, depth, format, type, pixels);
+            return;
+        }
+        EditBinding binding(*this);
+        glTexSubImage3D(target_, level, x, y, z, width, height, depth, format, type, pixels);
+    }
+
+    void compressedSubImage2D(GLint level, GLint x, GLint y, GLsizei width, GLsizei height,
+                              GLenum format, GLsizei imageSize, const void *data) const {
+        if (glHasDirectStateAccess()) {
+            glCompressedTextureSubImage2D(handle_, level, x, y, width, height, format, imageSize, data);
+            return;
+        }
+        EditBinding binding(*this);
+        glCompressedTexSubImage2D(target_, level, x, y, width, height, format, imageSize, data);
+    }
+
+    // Same as glGetTexLevelParameteriv
+    GLint levelParameteri(GLint level, GLenum name) const {
+        GLint value = 0;
+        if (glHasDirectStateAccess()) {
+            glGetTextureLevelParameteriv(handle_, level, name, &value);
+            return value;
+        }
+        EditBinding binding(*this);
+        glGetTexLevelParameteriv(target_, level, name, &value);
+        return value;
+    }
+
+    void parameteri(GLenum name, GLint value) const {
+        if (glHasDirectStateAccess()) {
+            glTextureParameteri(handle_, name, value);
+            return;
+        }
+        EditBinding binding(*this);
+        glTexParameteri(target_, name, value);
+    }
+
+    void generateMipmap() const {
+        if (glHasDirectStateAccess()) {
+            glGenerateTextureMipmap(handle_);
+            return;
+        }
+        EditBinding binding(*this);
+        glGenerateMipmap(target_);
+    }
+
     // Accessor methods
     GLuint getHandle() const {
         return handle_;
@@ -138,15 +359,63 @@ public:
 };
 
 
+// Light wrapper around a GL sampler object handle that automatically allocates
+// and deallocates. Can be casted to a GLuint.
+class GlSampler : Noncopyable {
+protected:
+  GLuint handle_;
+
+public:
+  GlSampler() {
+    GLCall(glGenSamplers(1, &handle_));
+    checkGlErrors();
+  }
+
+  ~GlSampler() {
+    glDeleteSamplers(1, &handle_);
+  }
+
+  // Casts to GLuint so can be used directly by glBindSampler and so on
+  operator GLuint() const {
+    return handle_;
+  }
+};
+
+
 // Light wrapper around a GL buffer object handle that automatically allocates
 // and deallocates. Can be casted to a GLuint.
+//
+// The methods below allocate, fill and map the buffer with direct state
+// access when the context has it. Otherwise they bind it to GL_ARRAY_BUFFER,
+// which unlike GL_ELEMENT_ARRAY_BUFFER is not part of the bound vertex array
+// object, for the call and then bind back whatever was bound there.
 class GlBufferObject : Noncopyable {
 protected:
   GLuint handle_;
 
+  // Binds the buffer to GL_ARRAY_BUFFER while in scope
+  class EditBinding : Noncopyable {
+    GLint previous_;
+
+  public:
+    explicit EditBinding(GLuint handle) : previous_(0) {
+      glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &previous_);
+      glBindBuffer(GL_ARRAY_BUFFER, handle);
+    }
+
+    ~EditBinding() {
+      glBindBuffer(GL_ARRAY_BUFFER, previous_);
+    }
+  };
+
 public:
   GlBufferObject() {
-    GLCall(glGenBuffers(1, &handle_));
+    if (glHasDirectStateAccess()) {
+      GLCall(glCreateBuffers(1, &handle_));
+    }
+    else {
+      GLCall(glGenBuffers(1, &handle_));
+    }
     checkGlErrors();
   }
 
@@ -158,6 +427,118 @@ public:
   operator GLuint() const {
     return handle_;
   }
+
+  void data(GLsizeiptr size, const void *data, GLenum usage) const {
+    if (glHasDirectStateAccess()) {
+      glNamedBufferData(handle_, size, data, usage);
+      return;
+    }
+    EditBinding binding(handle_);
+    glBufferData(GL_ARRAY_BUFFER, size, data, usage);
+  }
+
+  void subData(GLintptr offset, GLsizeiptr size, const void *data) const {
+    if (glHasDirectStateAccess()) {
+      glNamedBufferSubData(handle_, offset, size, data);
+      return;
+    }
+    EditBinding binding(handle_);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+  }
+
+  // Immutable storage; needs GL 4.4 or ARB_buffer_storage
+  void storage(GLsizeiptr size, const void *data, GLbitfield flags) const {
+    if (glHasDirectStateAccess()) {
+      glNamedBufferStorage(handle_, size, data, flags);
+      return;
+    }
+    EditBinding binding(handle_);
+    glBufferStorage(GL_ARRAY_BUFFER, size, data, flags);
+  }
+
+  void *mapRange(GLintptr offset, GLsizeiptr length, GLbitfield access) const {
+    if (glHasDirectStateAccess())
+      return glMapNamedBufferRange(handle_, offset, length, access);
+    EditBinding binding(handle_);
+    return glMapBufferRange(GL_ARRAY_BUFFER, offset, length, access);
+  }
+
+  // Returns false if the contents were lost while mapped
+  bool unmap() const {
+    if (glHasDirectStateAccess())
+      return glUnmapNamedBuffer(handle_) == GL_TRUE;
+    EditBinding binding(handle_);
+    return glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+  }
+};
+
+
+// Light wrapper around a GL vertex array object handle that automatically
+// allocates and deallocates. Can be casted to a GLuint.
+class GlVertexArray : Noncopyable {
+protected:
+  GLuint handle_;
+
+public:
+  GlVertexArray() {
+    GLCall(glGenVertexArrays(1, &handle_));
+    checkGlErrors();
+  }
+
+  ~GlVertexArray() {
+    glDeleteVertexArrays(1, &handle_);
+  }
+
+  // Casts to GLuint so can be used directly by glBindVertexArray and so on
+  operator GLuint() const {
+    return handle_;
+  }
+};
+
+
+// Light wrapper around a GL renderbuffer handle that automatically allocates
+// and deallocates. Can be casted to a GLuint.
+class GlRenderbuffer : Noncopyable {
+protected:
+  GLuint handle_;
+
+public:
+  GlRenderbuffer() {
+    GLCall(glGenRenderbuffers(1, &handle_));
+    checkGlErrors();
+  }
+
+  ~GlRenderbuffer() {
+    glDeleteRenderbuffers(1, &handle_);
+  }
+
+  // Casts to GLuint so can be used directly by glBindRenderbuffer and so on
+  operator GLuint() const {
+    return handle_;
+  }
+};
+
+
+// Light wrapper around a GL framebuffer object handle that automatically
+// allocates and deallocates. Can be casted to a GLuint.
+class GlFramebuffer : Noncopyable {
+protected:
+  GLuint handle_;
+
+public:
+  GlFramebuffer() {
+    GLCall(glGenFramebuffers(1, &handle_));
+    checkGlErrors();
+  }
+
+  ~GlFramebuffer() {
+    glDeleteFramebuffers(1, &handle_);
+  }
+
+  // Casts to GLuint so can be used directly by glBindFramebuffer and so on
+  operator GLuint() const {
+    return handle_;
+  }
 };
 
 
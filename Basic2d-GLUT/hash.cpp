@@ -0,0 +1,29 @@
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+
+using namespace std;
+
+uint64_t readAndHashFile(const char *filename, vector<char>& data) {
+  ifstream ifs(filename, ios::binary);
+  if (!ifs)
+    throw runtime_error(string("Cannot open file ") + filename);
+
+  ifs.seekg(0, ios::end);
+  const size_t len = ifs.tellg();
+  ifs.seekg(0, ios::beg);
+
+  data.resize(len);
+  if (len > 0 && !ifs.read(&data[0], len))
+    throw runtime_error(string("Cannot read file ") + filename);
+
+  return fnv1a64(data.empty() ? NULL : &data[0], data.size());
+}
+
+uint64_t hashFile(const char *filename) {
+  vector<char> data;
+  return readAndHashFile(filename, data);
+}
@@ -0,0 +1,35 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+static const uint64_t FNV1A64_SEED = 14695981039346656037ULL;
+
+// 64-bit FNV-1a hash of `len' bytes. Pass a previous result as `seed' to hash
+// data that is spread over several pieces.
+inline uint64_t fnv1a64(const void *data, size_t len, uint64_t seed = FNV1A64_SEED) {
+  const unsigned char *p = static_cast<const unsigned char*>(data);
+  uint64_t h = seed;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Hashes a single value into `seed'
+template<typename T>
+inline uint64_t fnv1a64Value(const T& value, uint64_t seed) {
+  return fnv1a64(&value, sizeof(T), seed);
+}
+
+// Reads a whole file into `data' and returns its hash. Throws runtime_error if
+// the file cannot be read.
+uint64_t readAndHashFile(const char *filename, std::vector<char>& data);
+
+// Same as above when only the hash is needed
+uint64_t hashFile(const char *filename);
+
+#endif
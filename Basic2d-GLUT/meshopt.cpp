@@ -0,0 +1,144 @@
+#include <cstring>
+#include <vector>
+
+#include "meshopt.h"
+
+using namespace std;
+
+double vertexCacheMissRatio(const uint32_t *indices, size_t numIndices, size_t numVertices, int cacheSize) {
+  if (numIndices < 3)
+    return 0;
+
+  // A vertex is in the FIFO if it was last pushed fewer than cacheSize
+  // pushes ago
+  vector<size_t> pushedAt(numVertices, 0);
+  size_t pushes = 0, misses = 0;
+  for (size_t i = 0; i < numIndices; ++i) {
+    const uint32_t v = indices[i];
+    if (pushedAt[v] == 0 || pushes - pushedAt[v] >= size_t(cacheSize)) {
+      pushedAt[v] = ++pushes;
+      ++misses;
+    }
+  }
+  return double(misses) / (numIndices / 3);
+}
+
+namespace {
+
+// Triangles around each vertex, and the state Tipsify keeps per vertex
+struct Adjacency {
+  vector<uint32_t> offsets;    // triangles of vertex v: triangles[offsets[v] .. offsets[v + 1])
+  vector<uint32_t> triangles;
+  vector<uint32_t> live;       // triangles of each vertex not emitted yet
+
+  Adjacency(const uint32_t *indices, size_t numIndices, size_t numVertices)
+    : offsets(numVertices + 1, 0), triangles(numIndices), live(numVertices, 0) {
+    for (size_t i = 0; i < numIndices; ++i)
+      ++live[indices[i]];
+    for (size_t v = 0; v < numVertices; ++v)
+      offsets[v + 1] = offsets[v] + live[v];
+
+    vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < numIndices; ++i)
+      triangles[fill[indices[i]]++] = uint32_t(i / 3);
+  }
+};
+
+}
+
+void optimizeVertexCache(uint32_t *indices, size_t numIndices, size_t numVertices, int cacheSize) {
+  const size_t numTriangles = numIndices / 3;
+  if (numTriangles < 2)
+    return;
+
+  Adjacency adjacency(indices, numIndices, numVertices);
+  vector<uint32_t>& live = adjacency.live;
+  vector<size_t> cachedAt(numVertices, 0);  // time stamp of the vertex's last entry into the cache
+  vector<char> emitted(numTriangles, 0);
+  vector<uint32_t> deadEnds, candidates, output;
+  output.reserve(numTriangles * 3);
+  size_t time = size_t(cacheSize) + 1;
+  size_t cursor = 0;  // vertices before it have no live triangles left
+
+  const size_t none = size_t(-1);
+  size_t fan = 0;
+  while (fan < numVertices && !live[fan])
+    ++fan;
+  while (fan < numVertices) {
+    // Emit every triangle left around the fanning vertex
+    candidates.clear();
+    for (uint32_t k = adjacency.offsets[fan]; k < adjacency.offsets[fan + 1]; ++k) {
+      const uint32_t t = adjacency.triangles[k];
+      if (emitted[t])
+        continue;
+      for (int c = 0; c < 3; ++c) {
+        const uint32_t v = indices[3 * t + c];
+        output.push_back(v);
+        deadEnds.push_back(v);
+        candidates.push_back(v);
+        --live[v];
+        if (time - cachedAt[v] > size_t(cacheSize))
+          cachedAt[v] = time++;
+      }
+      emitted[t] = 1;
+    }
+
+    // Fan next around the candidate that will still be in the cache once
+    // its triangles are emitted and has the most of them, or else the one
+    // that entered the cache last
+    size_t next = none;
+    size_t best = 0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      const uint32_t v = candidates[i];
+      if (!live[v])
+        continue;
+      size_t priority = 0;
+      if (time - cachedAt[v] + 2 * live[v] <= size_t(cacheSize))
+        priority = time - cachedAt[v];
+      if (next == none || priority > best) {
+        best = priority;
+        next = v;
+      }
+    }
+
+    // At a dead end, go back to the most recently used vertex with
+    // triangles left, or to the next such vertex in input order
+    while (next == none && !deadEnds.empty()) {
+      const uint32_t v = deadEnds.back();
+      deadEnds.pop_back();
+      if (live[v])
+        next = v;
+    }
+    if (next == none) {
+      while (cursor < numVertices && !live[cursor])
+        ++cursor;
+      next = cursor;
+    }
+    fan = next;
+  }
+
+  memcpy(indices, &output[0], output.size() * sizeof(uint32_t));
+}
+
+size_t optimizeVertexFetch(void *vertices, size_t vertexSize, size_t numVertices, uint32_t *indices,
+                           size_t numIndices) {
+  const uint32_t unused = uint32_t(-1);
+  vector<uint32_t> remap(numVertices, unused);
+  uint32_t numUsed = 0;
+  for (size_t i = 0; i < numIndices; ++i) {
+    uint32_t& r = remap[indices[i]];
+    if (r == unused)
+      r = numUsed++;
+    indices[i] = r;
+  }
+
+  vector<unsigned char> moved(size_t(numUsed) * vertexSize);
+  const unsigned char *src = static_cast<const unsigned char*>(vertices);
+  for (size_t v = 0; v < numVertices; ++v) {
+    if (remap[v] != unused)
+      memcpy(&moved[size_t(remap[v]) * vertexSize], src + v * vertexSize, vertexSize);
+  }
+  if (numUsed)
+    memcpy(vertices, &moved[0], moved.size());
+  return numUsed;
+}
@@ -0,0 +1,32 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <cstddef>
+#include <stdint.h>
+
+// Vertices the post-transform cache is assumed to hold
+static const int VERTEX_CACHE_SIZE = 16;
+
+// Average cache miss ratio (ACMR) of triangle list `indices': the number of
+// vertices transformed per triangle when they go through a FIFO cache of
+// `cacheSize' vertices. Ranges from about 0.5 for a well-ordered regular mesh
+// to 3.
+double vertexCacheMissRatio(const uint32_t *indices, size_t numIndices, size_t numVertices,
+                            int cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorders the triangles of `indices', which refer to `numVertices' vertices,
+// so that they reuse the post-transform cache well. Uses Tipsify (Sander,
+// Nehab and Barczak 2007): triangles are emitted in fans around a vertex,
+// moving next to the neighbor that is still in the cache and has the most
+// triangles left. Runs in time linear in the size of the mesh.
+void optimizeVertexCache(uint32_t *indices, size_t numIndices, size_t numVertices,
+                         int cacheSize = VERTEX_CACHE_SIZE);
+
+// Moves the `numVertices' vertices of `vertexSize' bytes in `vertices' into
+// the order `indices' first uses them in, and renumbers `indices' to match,
+// so that vertex fetches walk through memory. Vertices no triangle uses are
+// dropped. Returns the number of vertices left.
+size_t optimizeVertexFetch(void *vertices, size_t vertexSize, size_t numVertices, uint32_t *indices,
+                           size_t numIndices);
+
+#endif
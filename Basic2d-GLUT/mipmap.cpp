@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define MIPMAP_SSE2 1
+# include <emmintrin.h>
+#endif
+
+#include "mipmap.h"
+
+using namespace std;
+
+// Resolution of the linear-to-byte encoding table
+static const int ENCODE_STEPS = 4096;
+
+// Conversion tables between stored bytes and linear intensity in [0, 1]
+struct MipTables {
+  float decode[256];
+  unsigned char encode[ENCODE_STEPS];
+};
+
+static float srgbToLinear(float c) {
+  return c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float c) {
+  return c <= 0.0031308f ? c * 12.92f : 1.055f * pow(c, 1.f / 2.4f) - 0.055f;
+}
+
+static const MipTables *buildMipTables() {
+  static MipTables tables[2];
+  for (int i = 0; i < 256; ++i) {
+    tables[0].decode[i] = i / 255.f;
+    tables[1].decode[i] = srgbToLinear(i / 255.f);
+  }
+  for (int i = 0; i < ENCODE_STEPS; ++i) {
+    const float c = float(i) / (ENCODE_STEPS - 1);
+    tables[0].encode[i] = static_cast<unsigned char>(c * 255.f + .5f);
+    tables[1].encode[i] = static_cast<unsigned char>(linearToSrgb(c) * 255.f + .5f);
+  }
+  return tables;
+}
+
+// Built on first use; the uploader thread and the main thread may both get
+// here first, which the static initialization serializes
+static const MipTables& mipTables(bool srgb) {
+  static const MipTables *tables = buildMipTables();
+  return tables[srgb ? 1 : 0];
+}
+
+int mipLevelCount(int width, int height) {
+  int levels = 1;
+  while (width > 1 || height > 1) {
+    width = max(1, width / 2);
+    height = max(1, height / 2);
+    ++levels;
+  }
+  return levels;
+}
+
+// Decodes a row of pixels into one plane of linear intensities per channel
+static void decodeRow(const PackedPixel *row, int width, const MipTables& t, float *planes[3]) {
+  for (int x = 0; x < width; ++x) {
+    planes[0][x] = t.decode[row[x].r];
+    planes[1][x] = t.decode[row[x].g];
+    planes[2][x] = t.decode[row[x].b];
+  }
+}
+
+// sum[i] += add[i] for i in [0, n)
+static void addRow(float *sum, const float *add, int n) {
+  int i = 0;
+#ifdef MIPMAP_SSE2
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_loadu_ps(add + i)));
+#endif
+  for (; i < n; ++i)
+    sum[i] += add[i];
+}
+
+// Sums the columns of each destination texel in one channel's plane of
+// vertical sums, averages them over `rowTaps' rows and as many columns, and
+// returns the indices into the encoding table in `idx'. Destination texel x
+// covers source columns 2x and 2x + 1; when the source width is odd, the last
+// texel also takes the last column if the destination width was rounded
+// down, and only column 2x if it was rounded up.
+static void reduceRow(const float *sum, int srcWidth, int dstWidth, int rowTaps, int *idx) {
+  const int pairs = min(dstWidth, srcWidth / 2);
+  const float steps = ENCODE_STEPS - 1;
+  int x = 0;
+#ifdef MIPMAP_SSE2
+  // Four destination texels from eight source columns: even and odd
+  // columns are split apart and added
+  const __m128 scale = _mm_set1_ps(steps / (2 * rowTaps)), half = _mm_set1_ps(.5f);
+  for (; x + 4 <= pairs; x += 4) {
+    const __m128 lo = _mm_loadu_ps(sum + 2 * x), hi = _mm_loadu_ps(sum + 2 * x + 4);
+    const __m128 even = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 odd = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+    const __m128 v = _mm_add_ps(_mm_mul_ps(_mm_add_ps(even, odd), scale), half);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(idx + x), _mm_cvttps_epi32(v));
+  }
+#endif
+  for (; x < pairs; ++x)
+    idx[x] = int((sum[2 * x] + sum[2 * x + 1]) * (steps / (2 * rowTaps)) + .5f);
+
+  if (dstWidth > pairs) {
+    // Width rounded up: the last column is averaged with itself
+    idx[pairs] = int(sum[2 * pairs] * (steps / rowTaps) + .5f);
+  }
+  else if (srcWidth % 2 && srcWidth > 1 && dstWidth == pairs) {
+    // Width rounded down: the last column joins the last texel
+    const int last = dstWidth - 1;
+    idx[last] = int((sum[2 * last] + sum[2 * last + 1] + sum[2 * last + 2]) * (steps / (3 * rowTaps)) + .5f);
+  }
+}
+
+// Filters rows [y0, y1) of the destination level out of the source level.
+// Rows are footprinted like columns in reduceRow(), so odd sizes fold the
+// last row and column into a 3-wide footprint rather than dropping them.
+// Each source row is decoded once into planes of linear intensity; the sums
+// and the scaling to table indices use SSE2 where available.
+static void downsampleRows(const PackedPixel *src, int srcWidth, int srcHeight,
+                           PackedPixel *dst, int dstWidth, int dstHeight, int y0, int y1,
+                           const MipTables& t) {
+  vector<float> sumStore(3 * size_t(srcWidth)), rowStore(3 * size_t(srcWidth));
+  float *sums[3] = { &sumStore[0], &sumStore[srcWidth], &sumStore[2 * size_t(srcWidth)] };
+  float *rows[3] = { &rowStore[0], &rowStore[srcWidth], &rowStore[2 * size_t(srcWidth)] };
+  vector<int> idx(3 * size_t(dstWidth));
+
+  for (int y = y0; y < y1; ++y) {
+    int rowTaps = 1;
+    decodeRow(src + size_t(2 * y) * srcWidth, srcWidth, t, sums);
+    const bool foldLast = y == dstHeight - 1 && 2 * y + 2 == srcHeight - 1;
+    for (int r = 2 * y + 1; r < srcHeight && r <= 2 * y + (foldLast ? 2 : 1); ++r, ++rowTaps) {
+      decodeRow(src + size_t(r) * srcWidth, srcWidth, t, rows);
+      for (int c = 0; c < 3; ++c)
+        addRow(sums[c], rows[c], srcWidth);
+    }
+
+    for (int c = 0; c < 3; ++c)
+      reduceRow(sums[c], srcWidth, dstWidth, rowTaps, &idx[size_t(c) * dstWidth]);
+    PackedPixel *out = dst + size_t(y) * dstWidth;
+    for (int x = 0; x < dstWidth; ++x) {
+      out[x].r = t.encode[idx[x]];
+      out[x].g = t.encode[idx[dstWidth + x]];
+      out[x].b = t.encode[idx[2 * dstWidth + x]];
+    }
+  }
+}
+
+// Fewest destination rows worth handing to a thread of its own
+static const int ROWS_PER_THREAD = 32;
+
+void buildMipChain(const PackedPixel *pixels, int width, int height, bool srgb,
+                   vector<MipLevel>& levels) {
+  const MipTables& t = mipTables(srgb);
+  const int maxThreads = max(1, int(thread::hardware_concurrency()));
+
+  levels.resize(mipLevelCount(width, height) - 1);
+  const PackedPixel *src = pixels;
+  int srcWidth = width, srcHeight = height;
+  for (size_t i = 0; i < levels.size(); ++i) {
+    MipLevel& level = levels[i];
+    level.width = max(1, srcWidth / 2);
+    level.height = max(1, srcHeight / 2);
+    level.pixels.resize(level.width * level.height);
+
+    const int numThreads = min(maxThreads, max(1, level.height / ROWS_PER_THREAD));
+    vector<thread> threads;
+    for (int k = 0; k < numThreads - 1; ++k) {
+      threads.push_back(thread(downsampleRows, src, srcWidth, srcHeight, &level.pixels[0], level.width,
+                               level.height, level.height * k / numThreads, level.height * (k + 1) / numThreads,
+                               cref(t)));
+    }
+    downsampleRows(src, srcWidth, srcHeight, &level.pixels[0], level.width, level.height,
+                   level.height * (numThreads - 1) / numThreads, level.height, t);
+    for (size_t k = 0; k < threads.size(); ++k)
+      threads[k].join();
+
+    src = &level.pixels[0];
+    srcWidth = level.width;
+    srcHeight = level.height;
+  }
+}
+
+void downsampleImage(const PackedPixel *pixels, int width, int height, bool srgb, PackedPixel *dst) {
+  const int dstHeight = (height + 1) / 2;
+  downsampleRows(pixels, width, height, dst, (width + 1) / 2, dstHeight, 0, dstHeight, mipTables(srgb));
+}
@@ -0,0 +1,34 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <vector>
+
+#include "ppm.h"
+
+// One level of a mip chain
+struct MipLevel {
+  int width, height;
+  std::vector<PackedPixel> pixels;
+};
+
+// Number of levels in a full mip chain for a width x height image, including
+// the image itself
+int mipLevelCount(int width, int height);
+
+// Builds levels 1 to mipLevelCount() - 1 of the mip chain of an image into
+// `levels' (level 0 is the image itself and is not copied). Each level is a
+// 2x2 box filter of the previous one; where an odd size is halved, the last
+// row and column widen the last footprint to 3 texels instead of being
+// dropped. With `srgb' set, pixels are decoded from sRGB, averaged in linear
+// light and encoded back, which is what sampling a GL_SRGB texture expects;
+// otherwise the bytes are averaged as they are. Large levels are split by
+// rows across threads, and the sums are vectorized with SSE2 where available.
+void buildMipChain(const PackedPixel *pixels, int width, int height, bool srgb,
+                   std::vector<MipLevel>& levels);
+
+// Halves an image with the same filter, rounding odd sizes up so that the
+// last row and column are averaged with themselves. `dst' receives
+// (width + 1) / 2 x (height + 1) / 2 pixels.
+void downsampleImage(const PackedPixel *pixels, int width, int height, bool srgb, PackedPixel *dst);
+
+#endif
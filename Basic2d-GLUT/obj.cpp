@@ -0,0 +1,475 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include "obj.h"
+
+using namespace std;
+
+namespace {
+
+// The bytes of a file, mapped read-only. On Windows they are read into memory
+// instead.
+class FileBytes {
+  const char *data_;
+  size_t size_;
+  vector<char> copy_;
+
+  FileBytes(const FileBytes&);
+  const FileBytes& operator= (const FileBytes&);
+
+public:
+  explicit FileBytes(const char *filename);
+  ~FileBytes();
+
+  const char *begin() const {
+    return data_;
+  }
+
+  const char *end() const {
+    return data_ + size_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+};
+
+#ifdef _WIN32
+
+FileBytes::FileBytes(const char *filename) : data_(NULL), size_(0) {
+  ifstream f(filename, ios::binary);
+  if (!f)
+    throw runtime_error(string("objRead: cannot open ") + filename);
+  f.seekg(0, ios::end);
+  copy_.resize(size_t(f.tellg()));
+  f.seekg(0);
+  if (!copy_.empty() && !f.read(&copy_[0], copy_.size()))
+    throw runtime_error(string("objRead: cannot read ") + filename);
+  data_ = copy_.empty() ? NULL : &copy_[0];
+  size_ = copy_.size();
+}
+
+FileBytes::~FileBytes() {}
+
+#else
+
+FileBytes::FileBytes(const char *filename) : data_(NULL), size_(0) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    throw runtime_error(string("objRead: cannot open ") + filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw runtime_error(string("objRead: cannot read ") + filename);
+  }
+  size_ = size_t(st.st_size);
+  if (size_) {
+    void *mem = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) {
+      close(fd);
+      throw runtime_error(string("objRead: cannot map ") + filename);
+    }
+    // The chunks are parsed at the same time, so read the whole file ahead
+    madvise(mem, size_, MADV_WILLNEED);
+    data_ = static_cast<const char*>(mem);
+  }
+  close(fd);
+}
+
+FileBytes::~FileBytes() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+}
+
+#endif
+
+// What one thread parses: whole lines [begin, end) of the file
+struct ObjChunk {
+  const char *begin, *end;
+  vector<float> positions;  // x, y of each "v"
+  vector<float> colors;     // r, g, b of each "v"
+  vector<float> texCoords;  // u, v of each "vt"
+
+  // Position and texture coordinate index of each triangle corner, counted
+  // from 0; the texture coordinate is -1 if the face gives none. Indices
+  // listed in `relative' count from the first element of the chunk instead,
+  // as negative OBJ indices refer back from where they appear.
+  vector<int32_t> corners;
+  vector<size_t> relative;
+
+  // The corners of the face being parsed, like the above
+  vector<int32_t> face;
+  vector<char> faceRelative;
+
+  const char *error;
+};
+
+inline bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool isDigit(char c) {
+  return unsigned(c - '0') < 10;
+}
+
+inline const char *skipBlanks(const char *p, const char *end) {
+  while (p < end && isBlank(*p))
+    ++p;
+  return p;
+}
+
+// Numbers strtod reads for us: too many digits, out-of-range exponents, nan
+// and inf. Returns NULL if there is no number at p.
+const char *parseFloatSlow(const char *p, const char *end, float& value) {
+  char buf[64];
+  size_t n = 0;
+  while (p + n < end && n < sizeof(buf) - 1 && !isBlank(p[n]) && p[n] != '\n')
+    ++n;
+  memcpy(buf, p, n);
+  buf[n] = 0;
+  char *stop;
+  value = float(strtod(buf, &stop));
+  return stop == buf ? NULL : p + (stop - buf);
+}
+
+const double POWERS_OF_TEN[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Parses the decimal number at p into `value', giving the same result as
+// float(strtod()), and returns the first character after it, or NULL if there
+// is no number. A mantissa below 2^53 scaled by at most 10^22 is exact in a
+// double, so one multiplication or division rounds it correctly; that covers
+// the numbers OBJ exporters write, and anything else goes to strtod.
+const char *parseFloat(const char *p, const char *end, float& value) {
+  const char *start = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+
+  uint64_t mantissa = 0;
+  int exponent = 0, digits = 0;
+  bool any = false, truncated = false;
+  for (; p < end && isDigit(*p); ++p) {
+    any = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa != 0;
+    }
+    else {
+      truncated |= *p != '0';
+      ++exponent;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && isDigit(*p); ++p) {
+      any = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa != 0;
+        --exponent;
+      }
+      else {
+        truncated |= *p != '0';
+      }
+    }
+  }
+  if (!any)
+    return parseFloatSlow(start, end, value);
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool negativeExponent = false;
+    if (q < end && (*q == '-' || *q == '+'))
+      negativeExponent = *q++ == '-';
+    int e = 0, n = 0;
+    for (; q < end && isDigit(*q); ++q, ++n)
+      e = e * 10 + (*q - '0');
+    if (n == 0 || n > 4)
+      return parseFloatSlow(start, end, value);
+    exponent += negativeExponent ? -e : e;
+    p = q;
+  }
+
+  if (truncated || mantissa >> 53 || exponent < -22 || exponent > 22)
+    return parseFloatSlow(start, end, value);
+  double d = double(mantissa);
+  d = exponent < 0 ? d / POWERS_OF_TEN[-exponent] : d * POWERS_OF_TEN[exponent];
+  value = float(negative ? -d : d);
+  return p;
+}
+
+// Parses an OBJ index, which is never 0, into `index'. Returns NULL if there is
+// none.
+const char *parseIndex(const char *p, const char *end, int32_t& index) {
+  bool negative = false;
+  if (p < end && *p == '-') {
+    negative = true;
+    ++p;
+  }
+  int64_t v = 0;
+  const char *digits = p;
+  for (; p < end && isDigit(*p); ++p) {
+    v = v * 10 + (*p - '0');
+    if (v > INT32_MAX)
+      return NULL;
+  }
+  if (p == digits || v == 0)
+    return NULL;
+  index = int32_t(negative ? -v : v);
+  return p;
+}
+
+// Resolves an OBJ index into `c.face', `count' elements having been read so
+// far in the chunk
+void addFaceIndex(ObjChunk& c, int32_t index, size_t count) {
+  c.face.push_back(index < 0 ? int32_t(int64_t(count) + index) : index - 1);
+  c.faceRelative.push_back(index < 0);
+}
+
+// Parses the numbers of a "v" or "vt" line into `values', at most `max' of
+// them, and returns how many there were, or -1 on a malformed number
+int parseFloats(const char *p, const char *end, float *values, int max) {
+  int n = 0;
+  for (p = skipBlanks(p, end); p < end && n < max; p = skipBlanks(p, end)) {
+    p = parseFloat(p, end, values[n]);
+    if (!p || (p < end && !isBlank(*p)))
+      return -1;
+    ++n;
+  }
+  return n;
+}
+
+// Parses the corners of an "f" line, splitting the face into a fan of
+// triangles. Points and lines are skipped, like other primitives. Returns
+// false if the face is malformed.
+bool parseFace(ObjChunk& c, const char *p, const char *end) {
+  const size_t numPositions = c.positions.size() / 2, numTexCoords = c.texCoords.size() / 2;
+  c.face.clear();
+  c.faceRelative.clear();
+  for (p = skipBlanks(p, end); p < end; p = skipBlanks(p, end)) {
+    int32_t v, vt = 0, vn;
+    p = parseIndex(p, end, v);
+    if (!p)
+      return false;
+    if (p < end && *p == '/') {
+      ++p;
+      if (p < end && *p != '/' && !(p = parseIndex(p, end, vt)))
+        return false;
+      if (p < end && *p == '/' && !(p = parseIndex(p + 1, end, vn)))
+        return false;
+    }
+    if (p < end && !isBlank(*p))
+      return false;
+
+    addFaceIndex(c, v, numPositions);
+    if (vt) {
+      addFaceIndex(c, vt, numTexCoords);
+    }
+    else {
+      c.face.push_back(-1);
+      c.faceRelative.push_back(false);
+    }
+  }
+
+  const size_t numCorners = c.face.size() / 2;
+  for (size_t i = 2; i < numCorners; ++i) {
+    const size_t triangle[3] = { 0, i - 1, i };
+    for (int k = 0; k < 3; ++k) {
+      for (size_t j = 2 * triangle[k]; j < 2 * triangle[k] + 2; ++j) {
+        if (c.faceRelative[j])
+          c.relative.push_back(c.corners.size());
+        c.corners.push_back(c.face[j]);
+      }
+    }
+  }
+  return true;
+}
+
+void parseChunk(ObjChunk& c) {
+  for (const char *line = c.begin; line < c.end;) {
+    const char *eol = static_cast<const char*>(memchr(line, '\n', c.end - line));
+    if (!eol)
+      eol = c.end;
+    const char *p = skipBlanks(line, eol);
+    line = eol + 1;
+    if (p + 2 >= eol)
+      continue;
+
+    if (p[0] == 'v' && isBlank(p[1])) {
+      float v[6];
+      const int n = parseFloats(p + 1, eol, v, 6);
+      if (n < 2) {
+        c.error = "objRead: bad vertex";
+        return;
+      }
+      c.positions.push_back(v[0]);
+      c.positions.push_back(v[1]);
+      const bool colored = n == 6;
+      c.colors.push_back(colored ? v[3] : 1);
+      c.colors.push_back(colored ? v[4] : 1);
+      c.colors.push_back(colored ? v[5] : 1);
+    }
+    else if (p[0] == 'v' && p[1] == 't' && isBlank(p[2])) {
+      float vt[3];
+      const int n = parseFloats(p + 2, eol, vt, 3);
+      if (n < 1) {
+        c.error = "objRead: bad texture coordinates";
+        return;
+      }
+      c.texCoords.push_back(vt[0]);
+      c.texCoords.push_back(n > 1 ? vt[1] : 0);
+    }
+    else if (p[0] == 'f' && isBlank(p[1]) && !parseFace(c, p + 1, eol)) {
+      c.error = "objRead: bad face";
+      return;
+    }
+  }
+}
+
+// Fewest bytes worth handing to a thread of their own
+const size_t BYTES_PER_THREAD = 1 << 20;
+
+// Open addressing table of the distinct vertices, which are looked up by value
+class VertexTable {
+  vector<uint32_t> slots_;  // vertex index + 1, 0 when empty
+  size_t mask_;
+
+  static size_t hash(const ObjVertex& v) {
+    uint32_t words[sizeof(ObjVertex) / 4];
+    memcpy(words, &v, sizeof(words));
+    uint64_t h = 0;
+    for (size_t i = 0; i < sizeof(words) / 4; ++i)
+      h = (h ^ words[i]) * 0x9e3779b97f4a7c15ULL;
+    return size_t(h ^ (h >> 32));
+  }
+
+  void insert(const vector<ObjVertex>& vertices, uint32_t index) {
+    size_t i = hash(vertices[index]) & mask_;
+    while (slots_[i])
+      i = (i + 1) & mask_;
+    slots_[i] = index + 1;
+  }
+
+public:
+  explicit VertexTable(size_t expected) {
+    size_t size = 16;
+    while (size < expected * 2)
+      size *= 2;
+    slots_.assign(size, 0);
+    mask_ = size - 1;
+  }
+
+  // Returns the index of `v' in `vertices', appending it if it is new
+  uint32_t find(vector<ObjVertex>& vertices, const ObjVertex& v) {
+    size_t i = hash(v) & mask_;
+    for (; slots_[i]; i = (i + 1) & mask_) {
+      if (memcmp(&vertices[slots_[i] - 1], &v, sizeof(v)) == 0)
+        return slots_[i] - 1;
+    }
+    const uint32_t index = uint32_t(vertices.size());
+    vertices.push_back(v);
+    slots_[i] = index + 1;
+
+    // Kept at most half full, so that probe runs stay short
+    if (vertices.size() * 2 > slots_.size()) {
+      slots_.assign(slots_.size() * 2, 0);
+      mask_ = slots_.size() - 1;
+      for (uint32_t k = 0; k < vertices.size(); ++k)
+        insert(vertices, k);
+    }
+    return index;
+  }
+};
+
+}
+
+void objRead(const char *filename, vector<ObjVertex>& vertices, vector<uint32_t>& indices, ObjStats *stats) {
+  const FileBytes file(filename);
+
+  // Chunk boundaries are moved to the start of the next line
+  const int numThreads = int(min(size_t(max(1, int(thread::hardware_concurrency()))),
+                                 max(size_t(1), file.size() / BYTES_PER_THREAD)));
+  vector<ObjChunk> chunks(numThreads);
+  const char *p = file.begin();
+  for (int k = 0; k < numThreads; ++k) {
+    ObjChunk& c = chunks[k];
+    c.begin = p;
+    c.end = file.begin() + file.size() * (k + 1) / numThreads;
+    if (c.end < c.begin)
+      c.end = c.begin;
+    const char *eol = k + 1 < numThreads ? static_cast<const char*>(memchr(c.end, '\n', file.end() - c.end)) : NULL;
+    c.end = eol ? eol + 1 : file.end();
+    c.error = NULL;
+    p = c.end;
+  }
+
+  vector<thread> threads;
+  for (int k = 0; k < numThreads - 1; ++k)
+    threads.push_back(thread(parseChunk, ref(chunks[k])));
+  parseChunk(chunks[numThreads - 1]);
+  for (size_t k = 0; k < threads.size(); ++k)
+    threads[k].join();
+
+  // Gather the elements of every chunk, and make every corner count from the
+  // start of the file
+  vector<float> positions, colors, texCoords;
+  size_t numCorners = 0;
+  for (int k = 0; k < numThreads; ++k) {
+    ObjChunk& c = chunks[k];
+    if (c.error)
+      throw runtime_error(string(c.error) + " in " + filename);
+    const size_t bases[2] = { positions.size() / 2, texCoords.size() / 2 };
+    for (size_t i = 0; i < c.relative.size(); ++i)
+      c.corners[c.relative[i]] += int32_t(bases[c.relative[i] % 2]);
+    positions.insert(positions.end(), c.positions.begin(), c.positions.end());
+    colors.insert(colors.end(), c.colors.begin(), c.colors.end());
+    texCoords.insert(texCoords.end(), c.texCoords.begin(), c.texCoords.end());
+    numCorners += c.corners.size() / 2;
+    vector<float>().swap(c.positions);
+    vector<float>().swap(c.colors);
+    vector<float>().swap(c.texCoords);
+  }
+  const int64_t numPositions = positions.size() / 2, numTexCoords = texCoords.size() / 2;
+
+  vertices.clear();
+  indices.clear();
+  indices.reserve(numCorners);
+  VertexTable table(size_t(max(numPositions, numTexCoords)));
+  for (int k = 0; k < numThreads; ++k) {
+    const vector<int32_t>& corners = chunks[k].corners;
+    for (size_t i = 0; i < corners.size(); i += 2) {
+      const int32_t v = corners[i], vt = corners[i + 1];
+      if (v < 0 || v >= numPositions || vt < -1 || vt >= numTexCoords)
+        throw runtime_error(string("objRead: a face refers to a missing vertex in ") + filename);
+
+      ObjVertex vertex;
+      vertex.pos[0] = positions[2 * size_t(v)];
+      vertex.pos[1] = positions[2 * size_t(v) + 1];
+      vertex.tex[0] = vt < 0 ? 0 : texCoords[2 * size_t(vt)];
+      vertex.tex[1] = vt < 0 ? 0 : texCoords[2 * size_t(vt) + 1];
+      copy(&colors[3 * size_t(v)], &colors[3 * size_t(v)] + 3, vertex.color);
+      indices.push_back(table.find(vertices, vertex));
+    }
+  }
+
+  if (stats) {
+    stats->positions = size_t(numPositions);
+    stats->texCoords = size_t(numTexCoords);
+    stats->corners = numCorners;
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+// A vertex of a mesh read from an OBJ file: the x and y of its position, its
+// texture coordinates, and its color (white unless the file gives one with
+// the "v x y z r g b" extension)
+struct ObjVertex {
+  float pos[2];
+  float tex[2];
+  float color[3];
+};
+
+// Counts of what objRead() found, before deduplication
+struct ObjStats {
+  size_t positions, texCoords, corners;
+};
+
+// Reads the faces of Wavefront OBJ file `filename' as indexed triangles:
+// faces with more corners are split into fans. Corners with the same
+// position, texture coordinates and color share one vertex. Normals, groups
+// and materials are skipped. The file is mapped rather than read, split into
+// chunks of whole lines, and the chunks parsed on several threads. Throws
+// runtime_error on error.
+void objRead(const char *filename, std::vector<ObjVertex>& vertices, std::vector<uint32_t>& indices,
+             ObjStats *stats = 0);
+
+#endif
@@ -0,0 +1,66 @@
+// The SSSE3 kernel is compiled whatever the target, and only used if the CPU
+// running the program turns out to have SSSE3: GCC and Clang build it with a
+// target attribute, MSVC allows the intrinsics without /arch
+#if (defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))) || \
+    (defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64)))
+# define PIXELCONVERT_SSSE3 1
+# include <tmmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+#  define PIXELCONVERT_TARGET_SSSE3
+# else
+#  define PIXELCONVERT_TARGET_SSSE3 __attribute__((target("ssse3")))
+# endif
+#endif
+
+#include "pixelconvert.h"
+
+void expandRgbToBgraScalar(const PackedPixel *src, unsigned char *dst, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    dst[4 * i] = src[i].b;
+    dst[4 * i + 1] = src[i].g;
+    dst[4 * i + 2] = src[i].r;
+    dst[4 * i + 3] = 255;
+  }
+}
+
+#ifdef PIXELCONVERT_SSSE3
+
+static bool cpuHasSsse3() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 9)) != 0;
+#else
+  return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+// Four pixels per step: twelve of the sixteen bytes loaded are shuffled into
+// place and the alpha bytes, zeroed by the shuffle, are or'ed in. The load
+// reads four bytes past the fourth pixel, so the last pixels are left to the
+// caller. Returns the number of pixels expanded.
+PIXELCONVERT_TARGET_SSSE3
+static size_t expandRgbToBgraSsse3(const PackedPixel *src, unsigned char *dst, size_t count) {
+  size_t i = 0;
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  const unsigned char *in = reinterpret_cast<const unsigned char*>(src);
+  for (; i + 6 <= count; i += 4) {
+    const __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 3 * i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+  }
+  return i;
+}
+
+#endif
+
+void expandRgbToBgra(const PackedPixel *src, unsigned char *dst, size_t count) {
+  size_t i = 0;
+#ifdef PIXELCONVERT_SSSE3
+  static const bool ssse3 = cpuHasSsse3();
+  if (ssse3)
+    i = expandRgbToBgraSsse3(src, dst, count);
+#endif
+  expandRgbToBgraScalar(src + i, dst + 4 * i, count - i);
+}
@@ -0,0 +1,18 @@
+#ifndef PIXELCONVERT_H
+#define PIXELCONVERT_H
+
+#include <cstddef>
+
+#include "ppm.h"
+
+// Expands `count' RGB pixels to 4-byte BGRA pixels with an alpha of 255. This
+// is the layout most drivers keep 8-bit textures in, so uploading it as
+// GL_BGRA / GL_UNSIGNED_INT_8_8_8_8_REV lets them copy rows as they are
+// instead of repacking every texel. Uses an SSSE3 byte shuffle when the CPU
+// has it.
+void expandRgbToBgra(const PackedPixel *src, unsigned char *dst, size_t count);
+
+// The same, one pixel at a time
+void expandRgbToBgraScalar(const PackedPixel *src, unsigned char *dst, size_t count);
+
+#endif
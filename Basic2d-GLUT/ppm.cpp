@@ -75,11 +75,7 @@ static void ppmReadHeader(istream& is, int &width, int &height) {
 }
 
 //Reads the actual PPM data and stores returns in in a pixels.
-void ppmRead(const char *filename, int& width, int& height, std::vector<PackedPixel>& pixels) {
-  ifstream is(filename, ios::binary);
-  if (!is.is_open())
-    throw runtime_error(string("ppmRead: Cannot open file ") + filename + " for read");
-
+static void ppmReadStream(istream& is, int& width, int& height, std::vector<PackedPixel>& pixels) {
   // Sets bits to report IO error using exception
   is.exceptions(ios::eofbit | ios::failbit | ios::badbit);
 
@@ -113,4 +109,41 @@ void ppmRead(const char *filename, int& width, int& height, std::vector<PackedPi
       }
     }
   }
-}
\ No newline at end of file
+}
+
+void ppmRead(const char *filename, int& width, int& height, std::vector<PackedPixel>& pixels) {
+  ifstream is(filename, ios::binary);
+  if (!is.is_open())
+    throw runtime_error(string("ppmRead: Cannot open file ") + filename + " for read");
+  ppmReadStream(is, width, height, pixels);
+}
+
+// Stream buffer reading from memory in place, without the copy an
+// istringstream would make
+class MemoryStreamBuf : public streambuf {
+public:
+  MemoryStreamBuf(const char *data, size_t size) {
+    char *p = const_cast<char*>(data);
+    setg(p, p, p + size);
+  }
+};
+
+void ppmDecode(const char *data, size_t size, int& width, int& height, std::vector<PackedPixel>& pixels) {
+  MemoryStreamBuf buf(data, size);
+  istream is(&buf);
+  ppmReadStream(is, width, height, pixels);
+}
+
+void ppmOpen(const char *filename, std::ifstream& is, int& width, int& height) {
+  is.open(filename, ios::binary);
+  if (!is.is_open())
+    throw runtime_error(string("ppmOpen: Cannot open file ") + filename + " for read");
+  is.exceptions(ios::eofbit | ios::failbit | ios::badbit);
+
+  char buf[2];
+  is.read(buf, 2);
+  if (memcmp(buf, "P6", 2))
+    throw runtime_error("ppmOpen: only binary files can be read by rows");
+
+  ppmReadHeader(is, width, height);
+}
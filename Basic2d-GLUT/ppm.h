@@ -1,6 +1,8 @@
 #ifndef PPM_H
 #define PPM_H
 
+#include <cstddef>
+#include <fstream>
 #include <vector>
 
 void writePpmScreenshot(const int width, const int height, const char *filename);
@@ -15,4 +17,12 @@ struct PackedPixel {
 // and `height'. Throws an exception on error.
 void ppmRead(const char *filename, int& width, int& height, std::vector<PackedPixel>& pixels);
 
+// The same for an image file already read into the `size' bytes at `data'
+void ppmDecode(const char *data, size_t size, int& width, int& height, std::vector<PackedPixel>& pixels);
+
+// Opens a binary (P6) image file for reading row by row: `is' is left at the
+// first pixel of the top row, with exceptions enabled. For images too large to
+// read whole. Throws an exception on error.
+void ppmOpen(const char *filename, std::ifstream& is, int& width, int& height);
+
 #endif
@@ -0,0 +1,329 @@
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <pthread.h>
+# include <sys/file.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include "hash.h"
+#include "ppmcache.h"
+
+using namespace std;
+
+// Decoded images that could not go into the shared segment, by content hash,
+// so that a file changed on disk is decoded again. Never freed, so pointers
+// handed out stay valid like those into the segment. An empty image has no
+// pixels to point to and gives NULL.
+struct PrivatePpm {
+  int width, height;
+  vector<PackedPixel> pixels;
+};
+
+static mutex privateImagesMutex;
+static map<uint64_t, PrivatePpm> privateImages;
+
+static const PackedPixel *privateHit(const PrivatePpm& img, uint64_t hash, int& width, int& height,
+                                     uint64_t *contentHash) {
+  width = img.width;
+  height = img.height;
+  if (contentHash)
+    *contentHash = hash;
+  return img.pixels.empty() ? NULL : &img.pixels[0];
+}
+
+// Keeps an image decoded from contents with hash `hash', taking its pixels
+// unless the same contents were decoded before
+static const PackedPixel *ppmStorePrivate(uint64_t hash, vector<PackedPixel>& pixels, int& width, int& height,
+                                          uint64_t *contentHash) {
+  lock_guard<mutex> lock(privateImagesMutex);
+  pair<map<uint64_t, PrivatePpm>::iterator, bool> i = privateImages.insert(make_pair(hash, PrivatePpm()));
+  PrivatePpm& img = i.first->second;
+  if (i.second) {
+    img.width = width;
+    img.height = height;
+    img.pixels.swap(pixels);
+  }
+  return privateHit(img, hash, width, height, contentHash);
+}
+
+// Reads the file once, and decodes what was read unless the same contents
+// were decoded before
+static const PackedPixel *ppmReadPrivate(const char *filename, int& width, int& height, uint64_t *contentHash) {
+  vector<char> data;
+  const uint64_t hash = readAndHashFile(filename, data);
+  {
+    lock_guard<mutex> lock(privateImagesMutex);
+    map<uint64_t, PrivatePpm>::const_iterator i = privateImages.find(hash);
+    if (i != privateImages.end())
+      return privateHit(i->second, hash, width, height, contentHash);
+  }
+
+  vector<PackedPixel> pixels;
+  ppmDecode(data.empty() ? NULL : &data[0], data.size(), width, height, pixels);
+  return ppmStorePrivate(hash, pixels, width, height, contentHash);
+}
+
+#ifdef _WIN32
+
+const PackedPixel *ppmReadShared(const char *filename, int& width, int& height,
+                                 uint64_t *contentHash) {
+  return ppmReadPrivate(filename, width, height, contentHash);
+}
+
+#else
+
+static const uint32_t PPM_CACHE_MAGIC = 0x50504d43; // "PPMC"
+static const uint32_t PPM_CACHE_VERSION = 1;
+static const int PPM_CACHE_MAX_ENTRIES = 256;
+static const size_t PPM_CACHE_PATH_LEN = 256;
+static const uint64_t PPM_CACHE_ARENA_BYTES = 256 << 20; // sparse until used
+
+// One cached image. Several entries (one per path) may share the same pixels
+// when files have identical contents.
+struct PpmCacheEntry {
+  uint64_t contentHash;
+  uint64_t fileSize;
+  int64_t fileMtime;
+  uint64_t offset;      // of the pixels from the start of the arena
+  int width, height;
+  char path[PPM_CACHE_PATH_LEN];
+};
+
+struct PpmCacheHeader {
+  uint32_t magic, version;
+  pthread_mutex_t lock;
+  int numEntries;
+  uint64_t arenaUsed;
+  PpmCacheEntry entries[PPM_CACHE_MAX_ENTRIES];
+};
+
+static const size_t PPM_CACHE_ARENA_OFFSET = (sizeof(PpmCacheHeader) + 63) & ~size_t(63);
+static const size_t PPM_CACHE_SEGMENT_BYTES = PPM_CACHE_ARENA_OFFSET + PPM_CACHE_ARENA_BYTES;
+
+static string ppmCachePath() {
+  const char *env = getenv("ASST2_PPM_CACHE");
+  if (env && *env)
+    return env;
+  struct stat st;
+  return string(stat("/dev/shm", &st) == 0 ? "/dev/shm" : "/tmp") + "/asst2-ppm-cache";
+}
+
+// Maps the segment, creating and initializing it if this is the first process
+// to get here. Returns NULL if the segment cannot be used.
+static PpmCacheHeader *openPpmCache() {
+  const string path = ppmCachePath();
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd < 0)
+    return NULL;
+
+  // flock() serializes the one-time initialization; the robust mutex inside
+  // the segment takes over from there
+  flock(fd, LOCK_EX);
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  const bool fresh = ok && st.st_size == 0;
+  if (fresh)
+    ok = ftruncate(fd, PPM_CACHE_SEGMENT_BYTES) == 0;
+  else if (ok)
+    ok = size_t(st.st_size) == PPM_CACHE_SEGMENT_BYTES;
+
+  void *mem = MAP_FAILED;
+  if (ok)
+    mem = mmap(NULL, PPM_CACHE_SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  PpmCacheHeader *h = mem == MAP_FAILED ? NULL : static_cast<PpmCacheHeader*>(mem);
+  if (h && fresh) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    h->numEntries = 0;
+    h->arenaUsed = 0;
+    h->version = PPM_CACHE_VERSION;
+    h->magic = PPM_CACHE_MAGIC;
+  }
+  if (h && (h->magic != PPM_CACHE_MAGIC || h->version != PPM_CACHE_VERSION)) {
+    cerr << "WARN: " << path << " is not a compatible PPM cache, decoding privately" << endl;
+    munmap(mem, PPM_CACHE_SEGMENT_BYTES);
+    h = NULL;
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  return h;
+}
+
+static PpmCacheHeader *ppmCache() {
+  static once_flag opened;
+  static PpmCacheHeader *cache = NULL;
+  call_once(opened, [] { cache = openPpmCache(); });
+  return cache;
+}
+
+// Scoped holder of the cache mutex. Entries are only published once their
+// pixels are complete, so the index is consistent even if the previous owner
+// died while holding the lock.
+class PpmCacheLock {
+  pthread_mutex_t *m_;
+
+  PpmCacheLock(const PpmCacheLock&);
+  const PpmCacheLock& operator= (const PpmCacheLock&);
+
+public:
+  PpmCacheLock(pthread_mutex_t *m) : m_(m) {
+    if (pthread_mutex_lock(m_) == EOWNERDEAD)
+      pthread_mutex_consistent(m_);
+  }
+
+  ~PpmCacheLock() {
+    pthread_mutex_unlock(m_);
+  }
+};
+
+// Modification time in nanoseconds, so that a rewrite within the same second
+// is still noticed
+static int64_t mtimeNanos(const struct stat& st) {
+#ifdef __APPLE__
+  return int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+// Reads the whole file through one descriptor into `data', and sets `st' from
+// that descriptor, so that the size and modification time describe the
+// contents read. A file that changes while being read is read again.
+static void readFileWithStat(const char *filename, vector<char>& data, struct stat& st) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    throw runtime_error(string("Cannot open file ") + filename);
+
+  bool ok = false;
+  for (int attempt = 0; attempt < 3 && !ok; ++attempt) {
+    if (fstat(fd, &st) != 0)
+      break;
+    data.resize(st.st_size);
+    size_t got = 0;
+    while (got < data.size()) {
+      const ssize_t n = pread(fd, &data[got], data.size() - got, got);
+      if (n <= 0)
+        break;
+      got += n;
+    }
+    struct stat after;
+    ok = got == data.size() && fstat(fd, &after) == 0 && after.st_size == st.st_size &&
+         mtimeNanos(after) == mtimeNanos(st);
+  }
+  close(fd);
+  if (!ok)
+    throw runtime_error(string("Cannot read file ") + filename);
+}
+
+static const PackedPixel *entryPixels(PpmCacheHeader *h, const PpmCacheEntry& e) {
+  return reinterpret_cast<const PackedPixel*>(reinterpret_cast<const char*>(h) + PPM_CACHE_ARENA_OFFSET + e.offset);
+}
+
+static const PpmCacheEntry *findByPath(PpmCacheHeader *h, const char *path, const struct stat& st) {
+  for (int i = 0; i < h->numEntries; ++i) {
+    const PpmCacheEntry& e = h->entries[i];
+    if (e.fileSize == uint64_t(st.st_size) && e.fileMtime == mtimeNanos(st) && !strcmp(e.path, path))
+      return &e;
+  }
+  return NULL;
+}
+
+static const PpmCacheEntry *findByHash(PpmCacheHeader *h, uint64_t contentHash) {
+  for (int i = 0; i < h->numEntries; ++i) {
+    if (h->entries[i].contentHash == contentHash)
+      return &h->entries[i];
+  }
+  return NULL;
+}
+
+static const PackedPixel *hit(PpmCacheHeader *h, const PpmCacheEntry& e, int& width, int& height,
+                              uint64_t *contentHash) {
+  width = e.width;
+  height = e.height;
+  if (contentHash)
+    *contentHash = e.contentHash;
+  return entryPixels(h, e);
+}
+
+const PackedPixel *ppmReadShared(const char *filename, int& width, int& height,
+                                 uint64_t *contentHash) {
+  PpmCacheHeader *h = ppmCache();
+  struct stat st;
+  if (!h || stat(filename, &st) != 0)
+    return ppmReadPrivate(filename, width, height, contentHash);
+
+  // Index by absolute path, as processes may run from different directories
+  char absPath[PATH_MAX];
+  if (!realpath(filename, absPath) || strlen(absPath) >= PPM_CACHE_PATH_LEN)
+    return ppmReadPrivate(filename, width, height, contentHash);
+
+  // The lock is held while decoding, so that processes starting together wait
+  // for the first one instead of all decoding the same file
+  PpmCacheLock lock(&h->lock);
+
+  // Same path, unchanged on disk: no need to even read the file
+  if (const PpmCacheEntry *e = findByPath(h, absPath, st))
+    return hit(h, *e, width, height, contentHash);
+
+  // The file is read once: its size and modification time, its hash and the
+  // pixels all come from the same contents
+  vector<char> data;
+  readFileWithStat(filename, data, st);
+  const uint64_t hash = fnv1a64(data.empty() ? NULL : &data[0], data.size());
+  const PpmCacheEntry *shared = findByHash(h, hash);
+
+  vector<PackedPixel> pixels;
+  if (!shared)
+    ppmDecode(data.empty() ? NULL : &data[0], data.size(), width, height, pixels);
+
+  const uint64_t bytes = shared ? 0 : uint64_t(width) * height * sizeof(PackedPixel);
+  if (h->numEntries == PPM_CACHE_MAX_ENTRIES || h->arenaUsed + bytes > PPM_CACHE_ARENA_BYTES) {
+    if (shared)
+      return hit(h, *shared, width, height, contentHash);
+    cerr << "WARN: PPM cache is full, " << filename << " is kept privately" << endl;
+    return ppmStorePrivate(hash, pixels, width, height, contentHash);
+  }
+
+  PpmCacheEntry& e = h->entries[h->numEntries];
+  e.contentHash = hash;
+  e.fileSize = st.st_size;
+  e.fileMtime = mtimeNanos(st);
+  strcpy(e.path, absPath);
+  if (shared) {
+    e.offset = shared->offset;
+    e.width = shared->width;
+    e.height = shared->height;
+  }
+  else {
+    e.offset = h->arenaUsed;
+    e.width = width;
+    e.height = height;
+    if (bytes > 0)
+      memcpy(reinterpret_cast<char*>(h) + PPM_CACHE_ARENA_OFFSET + e.offset, &pixels[0], bytes);
+    h->arenaUsed += (bytes + 63) & ~uint64_t(63);
+  }
+  // Publish only now that the entry is complete
+  ++h->numEntries;
+
+  return hit(h, e, width, height, contentHash);
+}
+
+#endif
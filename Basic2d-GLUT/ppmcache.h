@@ -0,0 +1,23 @@
+#ifndef PPMCACHE_H
+#define PPMCACHE_H
+
+#include <stdint.h>
+
+#include "ppm.h"
+
+// Reads a PPM image through a decoded-pixel cache shared by every process on
+// the host. The cache is a file-backed shared memory segment (in /dev/shm, or
+// wherever the ASST2_PPM_CACHE environment variable points) holding decoded
+// pixels, indexed by file path and by a hash of the file contents. The first
+// process to ask for an image decodes it into the segment; later ones map the
+// same pixels. A robust process-shared mutex guards the index, so a process
+// dying while holding it does not block the others.
+//
+// Returns a pointer to `width' * `height' pixels that stays valid for the
+// lifetime of the process; the pixels must not be modified. If the segment
+// cannot be used (or on Windows) the image is decoded into private memory.
+// Throws an exception on error, like ppmRead.
+const PackedPixel *ppmReadShared(const char *filename, int& width, int& height,
+                                 uint64_t *contentHash = 0);
+
+#endif
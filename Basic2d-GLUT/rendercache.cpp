@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <direct.h>
+# include <io.h>
+# include <process.h>
+# include <sys/utime.h>
+#else
+# include <dirent.h>
+# include <unistd.h>
+# include <utime.h>
+#endif
+
+#include "rendercache.h"
+
+using namespace std;
+
+// An image file in the cache directory
+struct RenderCacheFile {
+  string path;
+  uint64_t bytes;
+  int64_t lastUse;     // modification time, in nanoseconds where available
+
+  bool operator< (const RenderCacheFile& other) const {
+    return lastUse < other.lastUse;
+  }
+};
+
+static void makeDirectory(const string& dir) {
+#ifdef _WIN32
+  const int rc = _mkdir(dir.c_str());
+#else
+  const int rc = mkdir(dir.c_str(), 0777);
+#endif
+  if (rc != 0 && errno != EEXIST)
+    throw runtime_error("RenderCache: cannot create directory " + dir);
+}
+
+static void listImages(const string& dir, vector<RenderCacheFile>& files) {
+  files.clear();
+#ifdef _WIN32
+  _finddata_t fd;
+  const intptr_t h = _findfirst((dir + "/*.ppm").c_str(), &fd);
+  if (h == -1)
+    return;
+  do {
+    RenderCacheFile f = { dir + "/" + fd.name, uint64_t(fd.size), int64_t(fd.time_write) * 1000000000 };
+    files.push_back(f);
+  } while (_findnext(h, &fd) == 0);
+  _findclose(h);
+#else
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (dirent *e = readdir(d)) {
+    const string name = e->d_name;
+    struct stat st;
+    if (name.size() < 4 || name.compare(name.size() - 4, 4, ".ppm") != 0)
+      continue;
+    if (stat((dir + "/" + name).c_str(), &st) != 0)
+      continue;
+#ifdef __APPLE__
+    const int64_t mtime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    const int64_t mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    RenderCacheFile f = { dir + "/" + name, uint64_t(st.st_size), mtime };
+    files.push_back(f);
+  }
+  closedir(d);
+#endif
+}
+
+static bool copyFile(const string& from, const string& to) {
+  ifstream in(from.c_str(), ios::binary);
+  if (!in)
+    return false;
+  ofstream out(to.c_str(), ios::binary);
+  out << in.rdbuf();
+  return bool(out);
+}
+
+RenderCache::RenderCache(const char *dir, uint64_t maxBytes)
+  : dir_(dir), maxBytes_(maxBytes), totalBytes_(0) {
+  stats_.hits = stats_.misses = stats_.stores = stats_.evictions = 0;
+  makeDirectory(dir_);
+
+  vector<RenderCacheFile> files;
+  listImages(dir_, files);
+  for (size_t i = 0; i < files.size(); ++i)
+    totalBytes_ += files[i].bytes;
+}
+
+string RenderCache::pathFor(uint64_t key) const {
+  char name[32];
+  sprintf(name, "/%016llx.ppm", static_cast<unsigned long long>(key));
+  return dir_ + name;
+}
+
+bool RenderCache::fetch(uint64_t key, const char *outFilename) {
+  const string path = pathFor(key);
+  if (!copyFile(path, outFilename)) {
+    ++stats_.misses;
+    return false;
+  }
+  // Mark as recently used for eviction
+  utime(path.c_str(), NULL);
+  ++stats_.hits;
+  return true;
+}
+
+void RenderCache::store(uint64_t key, const char *filename) {
+  // Write under a temporary name and rename, so that a concurrent fetch from
+  // another process never sees a partial image
+  const string path = pathFor(key);
+  char suffix[32];
+#ifdef _WIN32
+  sprintf(suffix, ".%d.tmp", _getpid());
+#else
+  sprintf(suffix, ".%d.tmp", int(getpid()));
+#endif
+  const string tmp = path + suffix;
+  if (!copyFile(filename, tmp)) {
+    remove(tmp.c_str());
+    throw runtime_error(string("RenderCache: cannot store ") + filename);
+  }
+#ifdef _WIN32
+  // rename() does not replace an existing file here; elsewhere it does so
+  // atomically, and removing first would let other processes miss the key
+  remove(path.c_str());
+#endif
+  if (rename(tmp.c_str(), path.c_str()) != 0) {
+    remove(tmp.c_str());
+    return;
+  }
+
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0)
+    totalBytes_ += st.st_size;
+  ++stats_.stores;
+  evict(path);
+}
+
+void RenderCache::evict(const string& keep) {
+  if (totalBytes_ <= maxBytes_)
+    return;
+
+  vector<RenderCacheFile> files;
+  listImages(dir_, files);
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < files.size(); ++i)
+    total += files[i].bytes;
+
+  // Evicting below the limit leaves room for a run of stores before the
+  // next scan
+  if (total > maxBytes_) {
+    const uint64_t target = maxBytes_ - maxBytes_ / 8;
+    sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size() && total > target; ++i) {
+      if (files[i].path != keep && remove(files[i].path.c_str()) == 0) {
+        total -= files[i].bytes;
+        ++stats_.evictions;
+      }
+    }
+  }
+  totalBytes_ = total;
+}
+
+void RenderCache::printStats(ostream& os) const {
+  const long lookups = stats_.hits + stats_.misses;
+  os << "render cache: " << stats_.hits << " hits, " << stats_.misses << " misses ("
+     << (lookups > 0 ? 100 * stats_.hits / lookups : 0) << "% hit rate), "
+     << stats_.stores << " stores, " << stats_.evictions << " evictions" << endl;
+}
@@ -0,0 +1,50 @@
+#ifndef RENDERCACHE_H
+#define RENDERCACHE_H
+
+#include <iostream>
+#include <string>
+#include <stdint.h>
+
+// Counters kept by a RenderCache since it was created
+struct RenderCacheStats {
+  long hits, misses, stores, evictions;
+};
+
+// On-disk store of rendered images, addressed by a hash of everything that
+// went into rendering them. Each image is a file named after its key in the
+// cache directory, so several processes can share one cache. When the total
+// size exceeds the limit, the least recently used images are deleted (use is
+// tracked through the file modification time) until it is an eighth below
+// the limit. The directory is only scanned once the running total of what
+// was there and what this process stored since exceeds the limit.
+class RenderCache {
+  std::string dir_;
+  uint64_t maxBytes_;
+  uint64_t totalBytes_;   // as of the last scan, plus this process's stores since
+  RenderCacheStats stats_;
+
+  RenderCache(const RenderCache&);
+  const RenderCache& operator= (const RenderCache&);
+
+  std::string pathFor(uint64_t key) const;
+  void evict(const std::string& keep);
+
+public:
+  // Creates `dir' if needed. Throws runtime_error if it cannot be created.
+  RenderCache(const char *dir, uint64_t maxBytes);
+
+  // Copies the image stored under `key' to `outFilename'. Returns false if
+  // there is no such image.
+  bool fetch(uint64_t key, const char *outFilename);
+
+  // Stores a copy of the image file `filename' under `key'
+  void store(uint64_t key, const char *filename);
+
+  const RenderCacheStats& stats() const {
+    return stats_;
+  }
+
+  void printStats(std::ostream& os) const;
+};
+
+#endif
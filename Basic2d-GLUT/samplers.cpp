@@ -0,0 +1,37 @@
+#include "samplers.h"
+
+using namespace std;
+
+bool SamplerState::operator<(const SamplerState& other) const {
+  if (minFilter != other.minFilter)
+    return minFilter < other.minFilter;
+  if (magFilter != other.magFilter)
+    return magFilter < other.magFilter;
+  if (wrapS != other.wrapS)
+    return wrapS < other.wrapS;
+  return wrapT < other.wrapT;
+}
+
+void applySamplerState(const GlTexture& texture, const SamplerState& state) {
+  texture.parameteri(GL_TEXTURE_MIN_FILTER, state.minFilter);
+  texture.parameteri(GL_TEXTURE_MAG_FILTER, state.magFilter);
+  texture.parameteri(GL_TEXTURE_WRAP_S, state.wrapS);
+  texture.parameteri(GL_TEXTURE_WRAP_T, state.wrapT);
+}
+
+bool SamplerRegistry::supported() {
+  return GLEW_VERSION_3_3 || GLEW_ARB_sampler_objects;
+}
+
+GLuint SamplerRegistry::get(const SamplerState& state) {
+  shared_ptr<GlSampler>& sampler = samplers_[state];
+  if (!sampler) {
+    sampler.reset(new GlSampler());
+    glSamplerParameteri(*sampler, GL_TEXTURE_MIN_FILTER, state.minFilter);
+    glSamplerParameteri(*sampler, GL_TEXTURE_MAG_FILTER, state.magFilter);
+    glSamplerParameteri(*sampler, GL_TEXTURE_WRAP_S, state.wrapS);
+    glSamplerParameteri(*sampler, GL_TEXTURE_WRAP_T, state.wrapT);
+    checkGlErrors();
+  }
+  return *sampler;
+}
@@ -0,0 +1,38 @@
+#ifndef SAMPLERS_H
+#define SAMPLERS_H
+
+#include <map>
+#include <memory>
+
+#include "glsupport.h"
+
+// How a texture is filtered and wrapped when sampled
+struct SamplerState {
+  GLenum minFilter, magFilter;
+  GLenum wrapS, wrapT;
+
+  bool operator<(const SamplerState& other) const;
+};
+
+// Sets the parameters of `texture', for contexts without sampler objects
+void applySamplerState(const GlTexture& texture, const SamplerState& state);
+
+// Sampler objects, one per distinct SamplerState. Textures are sampled through
+// the sampler bound to their unit, so changing how a group of textures is
+// filtered means binding another sampler rather than changing every texture.
+class SamplerRegistry : Noncopyable {
+  std::map<SamplerState, std::shared_ptr<GlSampler> > samplers_;
+
+public:
+  // True if the context has sampler objects (GL 3.3 or ARB_sampler_objects)
+  static bool supported();
+
+  // The sampler object for `state', created on first use
+  GLuint get(const SamplerState& state);
+
+  int size() const {
+    return int(samplers_.size());
+  }
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cstring>
+
+#include "spritebatch.h"
+
+using namespace std;
+
+static const int MAX_CAPACITY = 65536 / 4;
+
+namespace {
+
+// Orders quads by texture, keeping the order they were added in otherwise
+struct ByTexture {
+  const GLuint *textures;
+  bool operator() (int a, int b) const {
+    return textures[a] < textures[b];
+  }
+};
+
+}
+
+SpriteBatch::SpriteBatch(int capacity, GLuint positionLocation, GLuint texCoordLocation, GLuint colorLocation,
+                         StreamBuffer *stream)
+  : stream_(stream), capacity_(min(capacity, MAX_CAPACITY)), draws_(0) {
+  const VertexAttribute attributes[3] = {
+    VERTEX_ATTRIBUTE(Vertex, pos, positionLocation, GL_FALSE),
+    VERTEX_ATTRIBUTE(Vertex, tex, texCoordLocation, GL_FALSE),
+    VERTEX_ATTRIBUTE(Vertex, color, colorLocation, GL_TRUE),
+  };
+  copy(attributes, attributes + 3, attributes_);
+  format_ = vertexFormat<Vertex>(attributes_);
+
+  // The same two triangles for every quad, so the indices never change
+  vector<GLushort> indices(size_t(capacity_) * 6);
+  for (int q = 0; q < capacity_; ++q) {
+    const GLushort v = GLushort(q * 4);
+    const GLushort quad[6] = { v, GLushort(v + 1), GLushort(v + 2), v, GLushort(v + 2), GLushort(v + 3) };
+    copy(quad, quad + 6, &indices[size_t(q) * 6]);
+  }
+
+  indexVbo_.data(indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+  if (!stream_)
+    vbo_.data(capacity_ * 4 * sizeof(Vertex), NULL, GL_STREAM_DRAW);
+
+  glBindVertexArray(vao_);
+  if (!stream_)
+    setVertexAttributes(format_, vbo_);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexVbo_);
+  glBindVertexArray(0);
+  checkGlErrors();
+}
+
+void SpriteBatch::add(GLuint texture, const GLfloat transform[6], const GLfloat uv[4], const GLubyte color[4]) {
+  static const GLfloat corners[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+  const GLfloat *t = transform;
+
+  quads_.push_back(Quad());
+  Quad& q = quads_.back();
+  q.texture = texture;
+  for (int i = 0; i < 4; ++i) {
+    const GLfloat x = corners[i][0], y = corners[i][1];
+    Vertex& v = q.vertices[i];
+    v.pos[0] = t[0] * x + t[2] * y + t[4];
+    v.pos[1] = t[1] * x + t[3] * y + t[5];
+    v.tex[0] = x ? uv[2] : uv[0];
+    v.tex[1] = y ? uv[3] : uv[1];
+    copy(color, color + 4, v.color);
+  }
+}
+
+int SpriteBatch::flush(TextureUnits& units, GLuint program, GLint samplerLocation, GLuint sampler,
+                       bool sortByTexture) {
+  const int numQuads = int(quads_.size());
+  order_.resize(numQuads);
+  for (int i = 0; i < numQuads; ++i)
+    order_[i] = i;
+  if (sortByTexture) {
+    vector<GLuint> textures(numQuads);
+    for (int i = 0; i < numQuads; ++i)
+      textures[i] = quads_[i].texture;
+    ByTexture byTexture = { numQuads ? &textures[0] : NULL };
+    stable_sort(order_.begin(), order_.end(), byTexture);
+  }
+
+  glBindVertexArray(vao_);
+  int draws = 0;
+  for (int first = 0; first < numQuads; first += capacity_) {
+    const int n = min(capacity_, numQuads - first);
+
+    // The stream buffer gives out a new region for every fill, which the
+    // attributes are pointed at. The batch's own buffer is invalidated
+    // instead, so that the driver can hand out fresh memory while the GPU
+    // still reads what the last fill wrote.
+    const size_t bytes = size_t(n) * sizeof(quads_[0].vertices);
+    size_t offset = 0;
+    Vertex *mapped;
+    if (stream_) {
+      mapped = static_cast<Vertex*>(stream_->allocate(bytes, sizeof(Vertex), offset));
+    }
+    else {
+      mapped = static_cast<Vertex*>(vbo_.mapRange(0, capacity_ * 4 * sizeof(Vertex),
+                                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+      if (!mapped)
+        break;
+    }
+    for (int i = 0; i < n; ++i)
+      memcpy(mapped + size_t(i) * 4, quads_[order_[first + i]].vertices, sizeof(quads_[0].vertices));
+    if (stream_) {
+      stream_->commit();
+      setVertexAttributes(format_, stream_->buffer(), 0, offset);
+    }
+    else {
+      vbo_.unmap();
+    }
+
+    // One draw per run of quads sharing a texture
+    for (int run = 0; run < n;) {
+      const GLuint texture = quads_[order_[first + run]].texture;
+      int end = run + 1;
+      while (end < n && quads_[order_[first + end]].texture == texture)
+        ++end;
+
+      units.beginDraw();
+      units.setSampler(program, samplerLocation, units.bind(GL_TEXTURE_2D, texture, sampler));
+      glDrawElements(GL_TRIANGLES, (end - run) * 6, GL_UNSIGNED_SHORT,
+                     reinterpret_cast<const GLvoid*>(size_t(run) * 6 * sizeof(GLushort)));
+      ++draws;
+      run = end;
+    }
+  }
+  glBindVertexArray(0);
+  checkGlErrors();
+
+  quads_.clear();
+  draws_ += draws;
+  return draws;
+}
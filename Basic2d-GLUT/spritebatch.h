@@ -0,0 +1,74 @@
+#ifndef SPRITEBATCH_H
+#define SPRITEBATCH_H
+
+#include <vector>
+
+#include "glsupport.h"
+#include "streambuffer.h"
+#include "textureunits.h"
+#include "vertexformat.h"
+
+// Collects textured quads on the CPU and draws them with as few calls as
+// possible: the quads are written into a streaming vertex buffer, and each run
+// of quads sharing a texture becomes one glDrawElements. Sorting by texture
+// makes that one draw per texture, at the cost of the order between quads of
+// different textures; without it, runs are split wherever the texture changes.
+// Given a StreamBuffer, the vertices are written straight into it; otherwise
+// the batch's own buffer is invalidated and mapped again for every fill.
+class SpriteBatch : Noncopyable {
+public:
+  struct Vertex {
+    GLfloat pos[2];
+    GLfloat tex[2];
+    GLubyte color[4];
+  };
+
+private:
+  struct Quad {
+    GLuint texture;
+    Vertex vertices[4];
+  };
+
+  GlBufferObject vbo_, indexVbo_;
+  GlVertexArray vao_;
+  StreamBuffer *stream_;
+  VertexAttribute attributes_[3];
+  VertexFormat format_;
+  int capacity_;
+  std::vector<Quad> quads_;
+  std::vector<int> order_;
+  long draws_;
+
+public:
+  // Draws up to `capacity' quads per buffer fill, at most 16384 so that
+  // indices fit in 16 bits; more quads take several fills. Vertex positions,
+  // texture coordinates and colors are fed to the given attribute locations.
+  // `stream', if any, must outlive the batch, and the batch must only be
+  // flushed between its beginFrame() and endFrame().
+  SpriteBatch(int capacity, GLuint positionLocation, GLuint texCoordLocation, GLuint colorLocation,
+              StreamBuffer *stream = NULL);
+
+  // Appends the unit square [0, 1] x [0, 1] mapped by `transform', a 2x3
+  // affine matrix stored by columns (x' = t[0] x + t[2] y + t[4], y' = t[1] x +
+  // t[3] y + t[5]), showing region `uv' (u0, v0, u1, v1) of GL_TEXTURE_2D
+  // `texture', multiplied by `color'
+  void add(GLuint texture, const GLfloat transform[6], const GLfloat uv[4], const GLubyte color[4]);
+
+  // Number of quads added since the last flush
+  int size() const {
+    return int(quads_.size());
+  }
+
+  // Draws the quads added since the last flush with `program', which must be
+  // in use, binding each texture through `units' to sampler uniform
+  // `samplerLocation' with sampler object `sampler'. Returns the number of
+  // draw calls made.
+  int flush(TextureUnits& units, GLuint program, GLint samplerLocation, GLuint sampler, bool sortByTexture);
+
+  // Number of draw calls made so far
+  long draws() const {
+    return draws_;
+  }
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdexcept>
+
+#include "streambuffer.h"
+
+using namespace std;
+
+static const GLbitfield PERSISTENT_MAP_FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+StreamBuffer::StreamBuffer(size_t size)
+  : size_(size), head_(0), frameStart_(0), frameUsed_(0), mapped_(NULL), unmapPending_(false), stalls_(0),
+    bytesWritten_(0) {
+  orphaning_ = !(GLEW_VERSION_3_2 || GLEW_ARB_sync);
+
+  if (!orphaning_ && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)) {
+    buffer_.storage(size_, NULL, PERSISTENT_MAP_FLAGS);
+    mapped_ = static_cast<unsigned char*>(buffer_.mapRange(0, size_, PERSISTENT_MAP_FLAGS));
+    if (!mapped_)
+      throw runtime_error("StreamBuffer: cannot map the buffer");
+  }
+  else {
+    buffer_.data(size_, NULL, GL_STREAM_DRAW);
+  }
+  checkGlErrors();
+}
+
+StreamBuffer::~StreamBuffer() {
+  while (!inFlight_.empty()) {
+    glDeleteSync(inFlight_.front().fence);
+    inFlight_.pop_front();
+  }
+  if (mapped_ || unmapPending_)
+    buffer_.unmap();
+}
+
+size_t StreamBuffer::uniformAlignment() {
+  GLint alignment;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return size_t(alignment);
+}
+
+size_t StreamBuffer::storageAlignment() {
+  GLint alignment;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return size_t(alignment);
+}
+
+// Whether the data of frame `f' overlaps bytes [offset, offset + bytes)
+bool StreamBuffer::overlaps(const Frame& f, size_t offset, size_t bytes) const {
+  const size_t end = offset + bytes;
+  if (f.start < f.end)
+    return f.start < end && offset < f.end;
+  if (f.start > f.end)
+    return offset < f.end || end > f.start;
+  // Only a frame that filled the whole buffer starts where it ends
+  return true;
+}
+
+// Waits for the oldest frame in flight to be consumed and releases its data
+void StreamBuffer::retireOldest() {
+  Frame& f = inFlight_.front();
+  if (glClientWaitSync(f.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+    ++stalls_;
+    while (glClientWaitSync(f.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+      ;
+  }
+  glDeleteSync(f.fence);
+  inFlight_.pop_front();
+}
+
+void StreamBuffer::beginFrame() {
+  if (orphaning_) {
+    // The driver hands out new storage while the GPU finishes with the old
+    buffer_.data(size_, NULL, GL_STREAM_DRAW);
+    head_ = 0;
+  }
+  frameStart_ = head_;
+  frameUsed_ = 0;
+}
+
+void StreamBuffer::endFrame() {
+  commit();
+  if (orphaning_ || frameUsed_ == 0)
+    return;
+  Frame f = { frameStart_, head_, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) };
+  inFlight_.push_back(f);
+}
+
+void *StreamBuffer::allocate(size_t bytes, size_t alignment, size_t& offset) {
+  commit();
+
+  offset = (head_ + alignment - 1) / alignment * alignment;
+  if (offset + bytes > size_)
+    offset = 0;
+  // Bytes skipped to align or to wrap around count as used by the frame
+  const size_t used = (offset >= head_ ? offset - head_ : size_ - head_ + offset) + bytes;
+  if (frameUsed_ + used > size_)
+    throw runtime_error("StreamBuffer: a frame allocates more than the whole buffer");
+
+  // Frames are retired oldest first, so wait for every frame up to the
+  // newest one in the way
+  size_t retire = 0;
+  for (size_t i = 0; i < inFlight_.size(); ++i) {
+    if (overlaps(inFlight_[i], offset, bytes))
+      retire = i + 1;
+  }
+  while (retire-- > 0)
+    retireOldest();
+
+  frameUsed_ += used;
+  head_ = offset + bytes;
+  bytesWritten_ += bytes;
+
+  if (mapped_)
+    return mapped_ + offset;
+  void *p = buffer_.mapRange(offset, bytes,
+                             GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+  if (!p)
+    throw runtime_error("StreamBuffer: cannot map an allocation");
+  unmapPending_ = true;
+  return p;
+}
+
+void StreamBuffer::commit() {
+  if (!unmapPending_)
+    return;
+  buffer_.unmap();
+  unmapPending_ = false;
+}
@@ -0,0 +1,83 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <deque>
+#include <stdint.h>
+
+#include "glsupport.h"
+
+// A buffer that per-frame data (vertices, uniform blocks) is written into
+// directly, instead of being handed to glBufferData every frame. Allocations
+// go round the buffer as a ring; each frame's allocations are protected by a
+// fence placed at the end of the frame, and are reused once the GPU has
+// passed it. With GL 4.4 / ARB_buffer_storage the buffer stays mapped for its
+// whole life (persistent, coherent), so writes land in GPU-visible memory
+// without a driver copy; otherwise each allocation is mapped unsynchronized
+// on its own, as the fences already guarantee it is free. Without fence sync
+// objects the buffer is orphaned at the start of every frame instead.
+class StreamBuffer : Noncopyable {
+  struct Frame {
+    size_t start, end;  // may wrap around: end < start
+    GLsync fence;
+  };
+
+  GlBufferObject buffer_;
+  size_t size_, head_, frameStart_, frameUsed_;
+  unsigned char *mapped_;
+  bool orphaning_, unmapPending_;
+  std::deque<Frame> inFlight_;
+  long stalls_;
+  uint64_t bytesWritten_;
+
+  bool overlaps(const Frame& f, size_t offset, size_t bytes) const;
+  void retireOldest();
+
+public:
+  explicit StreamBuffer(size_t size);
+  ~StreamBuffer();
+
+  GLuint buffer() const {
+    return buffer_;
+  }
+
+  bool persistent() const {
+    return mapped_ != NULL;
+  }
+
+  // Starts a frame. Every allocation must be made between beginFrame() and
+  // endFrame().
+  void beginFrame();
+
+  // Fences the allocations of the frame, after the draws reading them
+  void endFrame();
+
+  // Reserves `bytes' (more than 0) at an offset that is a multiple of
+  // `alignment', which need not be a power of two, and returns where to write
+  // them; `offset' receives their offset in buffer(). Waits for the GPU if the
+  // ring has come round to data it may still read. The data must be committed
+  // before the GL reads it; the next allocation commits it too. Throws
+  // runtime_error if a frame allocates more than the whole buffer.
+  void *allocate(size_t bytes, size_t alignment, size_t& offset);
+
+  // Makes what was written since the last allocate() visible to the GL
+  void commit();
+
+  // Alignment that offsets bound with glBindBufferRange(GL_UNIFORM_BUFFER)
+  // must have
+  static size_t uniformAlignment();
+
+  // The same for glBindBufferRange(GL_SHADER_STORAGE_BUFFER), which needs
+  // GL 4.3
+  static size_t storageAlignment();
+
+  // Number of times an allocation had to wait for the GPU
+  long stalls() const {
+    return stalls_;
+  }
+
+  uint64_t bytesWritten() const {
+    return bytesWritten_;
+  }
+};
+
+#endif
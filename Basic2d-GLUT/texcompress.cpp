@@ -0,0 +1,482 @@
+#include <algorithm>
+#include <cerrno>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+# include <direct.h>
+# include <process.h>
+#else
+# include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define TEXCOMPRESS_SSE2 1
+# include <emmintrin.h>
+#endif
+
+#include "hash.h"
+#include "texcompress.h"
+
+using namespace std;
+
+// Bumped whenever the encoder output changes, so that stale cache entries are
+// not picked up
+static const uint32_t ENCODER_VERSION = 1;
+
+// 16 texels of a block, one array per channel
+struct Block {
+  float r[16], g[16], b[16];
+};
+
+// Endpoint pair of a block, as RGB in [0, 255]
+struct Endpoints {
+  float e0[3], e1[3];
+};
+
+static int blockBytes(BlockFormat format) {
+  return format == BLOCK_BC1 ? 8 : 16;
+}
+
+size_t blockCompressedSize(BlockFormat format, int width, int height) {
+  return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+static void loadBlock(const PackedPixel *pixels, int width, int height, int bx, int by, Block& block) {
+  for (int y = 0; y < 4; ++y) {
+    const PackedPixel *row = pixels + min(by * 4 + y, height - 1) * width;
+    for (int x = 0; x < 4; ++x) {
+      const PackedPixel& p = row[min(bx * 4 + x, width - 1)];
+      block.r[y * 4 + x] = p.r;
+      block.g[y * 4 + x] = p.g;
+      block.b[y * 4 + x] = p.b;
+    }
+  }
+}
+
+// Endpoints at the extremes of the texels projected on their principal axis
+static void fitPrincipalAxis(const Block& block, Endpoints& ep) {
+  float mean[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; ++i) {
+    mean[0] += block.r[i];
+    mean[1] += block.g[i];
+    mean[2] += block.b[i];
+  }
+  for (int c = 0; c < 3; ++c)
+    mean[c] /= 16;
+
+  float cov[6] = { 0, 0, 0, 0, 0, 0 };
+  for (int i = 0; i < 16; ++i) {
+    const float r = block.r[i] - mean[0], g = block.g[i] - mean[1], b = block.b[i] - mean[2];
+    cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+    cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+  }
+
+  // Power iteration, starting from the diagonal of the covariance
+  float axis[3] = { cov[0], cov[3], cov[5] };
+  for (int k = 0; k < 8; ++k) {
+    const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    const float len = max(fabs(x), max(fabs(y), fabs(z)));
+    if (len < 1e-6f)
+      break;
+    axis[0] = x / len;
+    axis[1] = y / len;
+    axis[2] = z / len;
+  }
+  const float norm = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  if (norm < 1e-6f) {
+    // Flat block
+    for (int c = 0; c < 3; ++c)
+      ep.e0[c] = ep.e1[c] = mean[c];
+    return;
+  }
+  for (int c = 0; c < 3; ++c)
+    axis[c] /= norm;
+
+  float tMin = FLT_MAX, tMax = -FLT_MAX;
+  for (int i = 0; i < 16; ++i) {
+    const float t = (block.r[i] - mean[0]) * axis[0] + (block.g[i] - mean[1]) * axis[1] +
+                    (block.b[i] - mean[2]) * axis[2];
+    tMin = min(tMin, t);
+    tMax = max(tMax, t);
+  }
+  for (int c = 0; c < 3; ++c) {
+    ep.e0[c] = min(255.f, max(0.f, mean[c] + tMax * axis[c]));
+    ep.e1[c] = min(255.f, max(0.f, mean[c] + tMin * axis[c]));
+  }
+}
+
+// Least-squares endpoints for the texels given which palette entry each one
+// uses. Palette entry i is e0 * (1 - weights[i]) + e1 * weights[i]. Returns
+// false if the system is degenerate (all texels on one entry).
+static bool fitLeastSquares(const Block& block, const unsigned char indices[16], const float *weights,
+                            Endpoints& ep) {
+  float a = 0, b = 0, c = 0;
+  float x0[3] = { 0, 0, 0 }, x1[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; ++i) {
+    const float w1 = weights[indices[i]], w0 = 1 - w1;
+    a += w0 * w0;
+    b += w0 * w1;
+    c += w1 * w1;
+    const float texel[3] = { block.r[i], block.g[i], block.b[i] };
+    for (int k = 0; k < 3; ++k) {
+      x0[k] += w0 * texel[k];
+      x1[k] += w1 * texel[k];
+    }
+  }
+  const float det = a * c - b * b;
+  if (fabs(det) < 1e-6f)
+    return false;
+  for (int k = 0; k < 3; ++k) {
+    ep.e0[k] = min(255.f, max(0.f, (c * x0[k] - b * x1[k]) / det));
+    ep.e1[k] = min(255.f, max(0.f, (a * x1[k] - b * x0[k]) / det));
+  }
+  return true;
+}
+
+// Picks the closest of `n' palette colors for every texel and returns the
+// total squared error
+static float selectIndices(const Block& block, const float (*palette)[3], int n, unsigned char indices[16]) {
+#ifdef TEXCOMPRESS_SSE2
+  // Four texels at a time, tracking the best distance and index per lane
+  __m128 total = _mm_setzero_ps();
+  for (int k = 0; k < 16; k += 4) {
+    const __m128 r = _mm_loadu_ps(block.r + k);
+    const __m128 g = _mm_loadu_ps(block.g + k);
+    const __m128 b = _mm_loadu_ps(block.b + k);
+    __m128 best = _mm_set1_ps(FLT_MAX);
+    __m128i bestIndex = _mm_setzero_si128();
+    for (int i = 0; i < n; ++i) {
+      const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[i][0]));
+      const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[i][1]));
+      const __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[i][2]));
+      const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+      const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+      best = _mm_min_ps(d, best);
+      bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)), _mm_andnot_si128(closer, bestIndex));
+    }
+    total = _mm_add_ps(total, best);
+    int lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+    for (int j = 0; j < 4; ++j)
+      indices[k + j] = static_cast<unsigned char>(lanes[j]);
+  }
+  float sums[4];
+  _mm_storeu_ps(sums, total);
+  return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+  float total = 0;
+  for (int k = 0; k < 16; ++k) {
+    float best = FLT_MAX;
+    for (int i = 0; i < n; ++i) {
+      const float dr = block.r[k] - palette[i][0], dg = block.g[k] - palette[i][1], db = block.b[k] - palette[i][2];
+      const float d = dr * dr + dg * dg + db * db;
+      if (d < best) {
+        best = d;
+        indices[k] = static_cast<unsigned char>(i);
+      }
+    }
+    total += best;
+  }
+  return total;
+#endif
+}
+
+/* B C 1 ************************************************************/
+
+static const float BC1_WEIGHTS[4] = { 0.f, 1.f, 1.f / 3, 2.f / 3 };
+
+static unsigned short packRgb565(const float c[3]) {
+  const int r = int(c[0] * 31 / 255 + .5f), g = int(c[1] * 63 / 255 + .5f), b = int(c[2] * 31 / 255 + .5f);
+  return static_cast<unsigned short>((r << 11) | (g << 5) | b);
+}
+
+static void unpackRgb565(unsigned short v, float c[3]) {
+  const int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+  c[0] = float((r << 3) | (r >> 2));
+  c[1] = float((g << 2) | (g >> 4));
+  c[2] = float((b << 3) | (b >> 2));
+}
+
+struct Bc1Candidate {
+  unsigned short c0, c1;
+  unsigned char indices[16];
+  float error;
+};
+
+// Quantizes a pair of endpoints and picks the texel indices, in four color
+// mode (c0 > c1). Equal endpoints leave a single color, which is index 0 in
+// either mode.
+static void tryBc1(const Block& block, const Endpoints& ep, Bc1Candidate& out) {
+  unsigned short c0 = packRgb565(ep.e0), c1 = packRgb565(ep.e1);
+  if (c0 < c1)
+    swap(c0, c1);
+
+  float palette[4][3];
+  unpackRgb565(c0, palette[0]);
+  unpackRgb565(c1, palette[1]);
+  for (int k = 0; k < 3; ++k) {
+    palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+    palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+  }
+  out.c0 = c0;
+  out.c1 = c1;
+  out.error = selectIndices(block, palette, c0 == c1 ? 1 : 4, out.indices);
+}
+
+static void encodeBc1Block(const Block& block, unsigned char *out) {
+  Endpoints ep;
+  fitPrincipalAxis(block, ep);
+  Bc1Candidate best;
+  tryBc1(block, ep, best);
+
+  // One refinement pass from the indices picked for the first guess
+  Endpoints refined;
+  if (best.c0 != best.c1 && fitLeastSquares(block, best.indices, BC1_WEIGHTS, refined)) {
+    Bc1Candidate candidate;
+    tryBc1(block, refined, candidate);
+    if (candidate.error < best.error)
+      best = candidate;
+  }
+
+  uint32_t bits = 0;
+  for (int i = 0; i < 16; ++i)
+    bits |= uint32_t(best.indices[i]) << (2 * i);
+  out[0] = best.c0 & 0xff;
+  out[1] = best.c0 >> 8;
+  out[2] = best.c1 & 0xff;
+  out[3] = best.c1 >> 8;
+  for (int i = 0; i < 4; ++i)
+    out[4 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+/* B C 7   M O D E   6 **********************************************/
+
+static const int BC7_WEIGHTS_4BIT[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+static const float BC7_WEIGHTS[16] = {
+  0 / 64.f, 4 / 64.f, 9 / 64.f, 13 / 64.f, 17 / 64.f, 21 / 64.f, 26 / 64.f, 30 / 64.f,
+  34 / 64.f, 38 / 64.f, 43 / 64.f, 47 / 64.f, 51 / 64.f, 55 / 64.f, 60 / 64.f, 64 / 64.f
+};
+
+// An endpoint as stored: 7 bits per RGBA channel plus a shared p-bit
+struct Bc7Endpoint {
+  int rgba[4];
+  int pbit;
+
+  int value(int c) const {
+    return (rgba[c] << 1) | pbit;
+  }
+};
+
+// Quantizes an opaque color, choosing the p-bit with the smaller error
+static Bc7Endpoint quantizeBc7(const float c[3]) {
+  Bc7Endpoint best = Bc7Endpoint();
+  float bestError = FLT_MAX;
+  for (int p = 0; p < 2; ++p) {
+    Bc7Endpoint e;
+    e.pbit = p;
+    float error = 0;
+    for (int k = 0; k < 4; ++k) {
+      const float target = k < 3 ? c[k] : 255.f;
+      e.rgba[k] = min(127, max(0, int((target - p) / 2 + .5f)));
+      const float d = e.value(k) - target;
+      error += d * d;
+    }
+    if (error < bestError) {
+      best = e;
+      bestError = error;
+    }
+  }
+  return best;
+}
+
+struct Bc7Candidate {
+  Bc7Endpoint e0, e1;
+  unsigned char indices[16];
+  float error;
+};
+
+static void tryBc7(const Block& block, const Endpoints& ep, Bc7Candidate& out) {
+  out.e0 = quantizeBc7(ep.e0);
+  out.e1 = quantizeBc7(ep.e1);
+
+  float palette[16][3];
+  for (int i = 0; i < 16; ++i) {
+    const int w = BC7_WEIGHTS_4BIT[i];
+    for (int k = 0; k < 3; ++k)
+      palette[i][k] = float(((64 - w) * out.e0.value(k) + w * out.e1.value(k) + 32) >> 6);
+  }
+  out.error = selectIndices(block, palette, 16, out.indices);
+}
+
+// Appends the `count' low bits of `value' to a little-endian bit stream
+static void putBits(unsigned char *out, int& pos, uint32_t value, int count) {
+  for (int i = 0; i < count; ++i, ++pos) {
+    if (value & (1u << i))
+      out[pos >> 3] |= static_cast<unsigned char>(1 << (pos & 7));
+  }
+}
+
+static void encodeBc7Block(const Block& block, unsigned char *out) {
+  Endpoints ep;
+  fitPrincipalAxis(block, ep);
+  Bc7Candidate best;
+  tryBc7(block, ep, best);
+
+  Endpoints refined;
+  if (fitLeastSquares(block, best.indices, BC7_WEIGHTS, refined)) {
+    Bc7Candidate candidate;
+    tryBc7(block, refined, candidate);
+    if (candidate.error < best.error)
+      best = candidate;
+  }
+
+  // The first index is stored without its top bit, which must be clear:
+  // swapping the endpoints mirrors every index
+  if (best.indices[0] & 8) {
+    swap(best.e0, best.e1);
+    for (int i = 0; i < 16; ++i)
+      best.indices[i] = 15 - best.indices[i];
+  }
+
+  memset(out, 0, 16);
+  int pos = 0;
+  putBits(out, pos, 1 << 6, 7);  // mode 6
+  for (int c = 0; c < 4; ++c) {
+    putBits(out, pos, best.e0.rgba[c], 7);
+    putBits(out, pos, best.e1.rgba[c], 7);
+  }
+  putBits(out, pos, best.e0.pbit, 1);
+  putBits(out, pos, best.e1.pbit, 1);
+  putBits(out, pos, best.indices[0], 3);
+  for (int i = 1; i < 16; ++i)
+    putBits(out, pos, best.indices[i], 4);
+}
+
+/* I M A G E S ******************************************************/
+
+static void compressBlockRows(BlockFormat format, const PackedPixel *pixels, int width, int height,
+                              unsigned char *blocks, int row0, int row1) {
+  const int blocksX = (width + 3) / 4;
+  const int bytes = blockBytes(format);
+  Block block;
+  for (int by = row0; by < row1; ++by) {
+    for (int bx = 0; bx < blocksX; ++bx) {
+      loadBlock(pixels, width, height, bx, by, block);
+      unsigned char *out = blocks + (size_t(by) * blocksX + bx) * bytes;
+      if (format == BLOCK_BC1)
+        encodeBc1Block(block, out);
+      else
+        encodeBc7Block(block, out);
+    }
+  }
+}
+
+// Fewest rows of blocks worth handing to a thread of its own
+static const int BLOCK_ROWS_PER_THREAD = 8;
+
+void compressImage(BlockFormat format, const PackedPixel *pixels, int width, int height,
+                   vector<unsigned char>& blocks) {
+  blocks.resize(blockCompressedSize(format, width, height));
+  if (blocks.empty())
+    return;
+  const int blockRows = (height + 3) / 4;
+  const int numThreads = min(max(1, int(thread::hardware_concurrency())),
+                             max(1, blockRows / BLOCK_ROWS_PER_THREAD));
+  vector<thread> threads;
+  for (int k = 0; k < numThreads - 1; ++k) {
+    threads.push_back(thread(compressBlockRows, format, pixels, width, height, &blocks[0],
+                             blockRows * k / numThreads, blockRows * (k + 1) / numThreads));
+  }
+  compressBlockRows(format, pixels, width, height, &blocks[0],
+                    blockRows * (numThreads - 1) / numThreads, blockRows);
+  for (size_t k = 0; k < threads.size(); ++k)
+    threads[k].join();
+}
+
+/* C A C H E ********************************************************/
+
+static const char CACHE_MAGIC[4] = { 'B', 'C', 'C', 'H' };
+
+static string cachePath(const char *dir, uint64_t key, BlockFormat format) {
+  const uint64_t h = fnv1a64Value(ENCODER_VERSION, fnv1a64Value(uint32_t(format), key));
+  char name[32];
+  sprintf(name, "/%016llx.bc", static_cast<unsigned long long>(h));
+  return string(dir) + name;
+}
+
+bool readCompressedCache(const char *dir, uint64_t key, BlockFormat format, vector<CompressedLevel>& levels) {
+  ifstream in(cachePath(dir, key, format).c_str(), ios::binary);
+  if (!in)
+    return false;
+
+  char magic[4];
+  uint32_t storedFormat, numLevels;
+  in.read(magic, 4);
+  in.read(reinterpret_cast<char*>(&storedFormat), sizeof(storedFormat));
+  in.read(reinterpret_cast<char*>(&numLevels), sizeof(numLevels));
+  if (!in || memcmp(magic, CACHE_MAGIC, 4) != 0 || storedFormat != uint32_t(format) || numLevels > 32)
+    return false;
+
+  levels.resize(numLevels);
+  for (uint32_t i = 0; i < numLevels; ++i) {
+    int32_t size[2];
+    in.read(reinterpret_cast<char*>(size), sizeof(size));
+    if (!in || size[0] <= 0 || size[1] <= 0 || size[0] > 65536 || size[1] > 65536)
+      return false;
+    levels[i].width = size[0];
+    levels[i].height = size[1];
+    levels[i].blocks.resize(blockCompressedSize(format, size[0], size[1]));
+    in.read(reinterpret_cast<char*>(&levels[i].blocks[0]), levels[i].blocks.size());
+  }
+  return bool(in);
+}
+
+void writeCompressedCache(const char *dir, uint64_t key, BlockFormat format,
+                          const vector<CompressedLevel>& levels) {
+#ifdef _WIN32
+  _mkdir(dir);
+#else
+  mkdir(dir, 0777);
+#endif
+
+  // Written under a temporary name and renamed, so that other processes never
+  // read a partial file
+  const string path = cachePath(dir, key, format);
+  char suffix[32];
+#ifdef _WIN32
+  sprintf(suffix, ".%d.tmp", _getpid());
+#else
+  sprintf(suffix, ".%d.tmp", int(getpid()));
+#endif
+  const string tmp = path + suffix;
+  {
+    ofstream out(tmp.c_str(), ios::binary);
+    const uint32_t storedFormat = format, numLevels = uint32_t(levels.size());
+    out.write(CACHE_MAGIC, 4);
+    out.write(reinterpret_cast<const char*>(&storedFormat), sizeof(storedFormat));
+    out.write(reinterpret_cast<const char*>(&numLevels), sizeof(numLevels));
+    for (size_t i = 0; i < levels.size(); ++i) {
+      const int32_t size[2] = { levels[i].width, levels[i].height };
+      out.write(reinterpret_cast<const char*>(size), sizeof(size));
+      out.write(reinterpret_cast<const char*>(&levels[i].blocks[0]), levels[i].blocks.size());
+    }
+    if (!out) {
+      out.close();
+      remove(tmp.c_str());
+      return;
+    }
+  }
+  remove(path.c_str());
+  if (rename(tmp.c_str(), path.c_str()) != 0)
+    remove(tmp.c_str());
+}
@@ -0,0 +1,46 @@
+#ifndef TEXCOMPRESS_H
+#define TEXCOMPRESS_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+#include "ppm.h"
+
+// Block-compressed formats the encoder produces. Both store 4x4 blocks of
+// texels: BC1 (S3TC DXT1, RGB) in 8 bytes per block, BC7 (BPTC) in 16 bytes
+// per block. Only BC7 mode 6 is used: one subset, RGBA endpoints with a
+// p-bit each, and 4-bit indices.
+enum BlockFormat {
+  BLOCK_BC1,
+  BLOCK_BC7
+};
+
+// Bytes taken by a compressed width x height image, counting partial blocks
+// on the right and bottom edges as whole blocks
+size_t blockCompressedSize(BlockFormat format, int width, int height);
+
+// Compresses an opaque image into `blocks', one row of blocks after the other.
+// Partial blocks are padded by repeating the last row and column. Rows of
+// blocks are split across threads, and the search for each texel's palette
+// entry uses SSE2 where available. An empty image gives no blocks.
+void compressImage(BlockFormat format, const PackedPixel *pixels, int width, int height,
+                   std::vector<unsigned char>& blocks);
+
+// One compressed mip level
+struct CompressedLevel {
+  int width, height;
+  std::vector<unsigned char> blocks;
+};
+
+// Reads the compressed mip chain stored under `key' in directory `dir'.
+// Returns false if there is none for `format'.
+bool readCompressedCache(const char *dir, uint64_t key, BlockFormat format,
+                         std::vector<CompressedLevel>& levels);
+
+// Stores a compressed mip chain under `key', creating `dir' if needed. Write
+// errors are ignored; the chain is then simply compressed again next time.
+void writeCompressedCache(const char *dir, uint64_t key, BlockFormat format,
+                          const std::vector<CompressedLevel>& levels);
+
+#endif
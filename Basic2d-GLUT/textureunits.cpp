@@ -0,0 +1,85 @@
+#include <stdexcept>
+
+#include "textureunits.h"
+
+using namespace std;
+
+TextureUnits::TextureUnits() : activeUnit_(-1), draw_(1), binds_(0) {
+  GLint numUnits;
+  glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &numUnits);
+  Unit empty = { GL_TEXTURE_2D, 0, 0, 0 };
+  units_.assign(numUnits, empty);
+}
+
+GLint TextureUnits::bind(GLenum target, GLuint texture, GLuint sampler) {
+  const pair<GLenum, GLuint> key(target, texture);
+  map<pair<GLenum, GLuint>, int>::iterator i = unitOf_.find(key);
+  if (i != unitOf_.end()) {
+    Unit& u = units_[i->second];
+    if (u.sampler != sampler) {
+      glBindSampler(i->second, sampler);
+      u.sampler = sampler;
+    }
+    u.lastDraw = draw_;
+    return i->second;
+  }
+
+  // An empty unit if there is one, otherwise the least recently used unit
+  // not taken by the current draw
+  int unit = -1;
+  for (int u = 0; u < int(units_.size()); ++u) {
+    if (units_[u].lastDraw == draw_)
+      continue;
+    if (unit < 0 || units_[u].texture == 0 || units_[u].lastDraw < units_[unit].lastDraw)
+      unit = u;
+    if (units_[u].texture == 0)
+      break;
+  }
+  if (unit < 0)
+    throw runtime_error("TextureUnits: a draw uses more textures than there are texture units");
+
+  if (activeUnit_ != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    activeUnit_ = unit;
+  }
+  Unit& u = units_[unit];
+  if (u.texture != 0) {
+    unitOf_.erase(make_pair(u.target, u.texture));
+    // Leave no texture of another type behind on the unit
+    if (u.target != target)
+      glBindTexture(u.target, 0);
+  }
+  glBindTexture(target, texture);
+  ++binds_;
+  if (u.sampler != sampler) {
+    glBindSampler(unit, sampler);
+    u.sampler = sampler;
+  }
+
+  u.target = target;
+  u.texture = texture;
+  u.lastDraw = draw_;
+  unitOf_[key] = unit;
+  return unit;
+}
+
+void TextureUnits::setSampler(GLuint program, GLint location, GLint unit) {
+  if (location < 0)
+    return;
+  map<pair<GLuint, GLint>, GLint>::iterator i = samplers_.find(make_pair(program, location));
+  if (i != samplers_.end() && i->second == unit)
+    return;
+  glUniform1i(location, unit);
+  samplers_[make_pair(program, location)] = unit;
+}
+
+void TextureUnits::invalidate() {
+  // Unit bindings are now unknown; rebinding over them is always correct
+  for (size_t u = 0; u < units_.size(); ++u) {
+    units_[u].texture = 0;
+    units_[u].lastDraw = 0;
+  }
+  unitOf_.clear();
+  samplers_.clear();
+  activeUnit_ = -1;
+}
@@ -0,0 +1,62 @@
+#ifndef TEXTUREUNITS_H
+#define TEXTUREUNITS_H
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "glsupport.h"
+
+// Assigns texture units to textures and keeps track of what is bound to each
+// unit of the current context, so that glActiveTexture and glBindTexture are
+// only called when they change something. A texture keeps its unit across
+// draws until the unit is needed for another texture, least recently used
+// first. Sampler uniform values are cached per program the same way, so they
+// are only set when the unit behind them changes, and the sampler object bound
+// to each unit is tracked along with its texture.
+class TextureUnits : Noncopyable {
+  struct Unit {
+    GLenum target;
+    GLuint texture, sampler;
+    unsigned lastDraw;
+  };
+
+  std::vector<Unit> units_;
+  std::map<std::pair<GLenum, GLuint>, int> unitOf_;
+  std::map<std::pair<GLuint, GLint>, GLint> samplers_;
+  int activeUnit_;
+  unsigned draw_;
+  long binds_;
+
+public:
+  // Uses up to GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS units
+  TextureUnits();
+
+  // Starts a new draw: textures bound for earlier draws may give up their unit
+  void beginDraw() {
+    ++draw_;
+  }
+
+  // Makes `texture' available to the current draw, sampled through sampler
+  // object `sampler' (0 for the texture's own parameters), and returns its
+  // unit. Throws runtime_error if the draw uses more textures than there are
+  // units.
+  GLint bind(GLenum target, GLuint texture, GLuint sampler = 0);
+
+  // Sets sampler uniform `location' of `program', which must be in use, to
+  // `unit'. Locations of -1 are ignored, as with safe_glUniform1i.
+  void setSampler(GLuint program, GLint location, GLint unit);
+
+  // Forgets all cached texture bindings and sampler uniforms. Must be called
+  // when textures are bound or sampler uniforms set behind the manager's back,
+  // or when a program is relinked. Sampler object bindings are kept, as only
+  // the manager binds sampler objects.
+  void invalidate();
+
+  // Number of glBindTexture calls made so far
+  long binds() const {
+    return binds_;
+  }
+};
+
+#endif
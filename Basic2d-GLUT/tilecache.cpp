@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "tilecache.h"
+
+using namespace std;
+
+TileCache::TileCache(const char *filename, size_t capacity)
+  : image_(filename), capacity_(max(size_t(1), capacity)), reads_(0), stopping_(false) {
+  thread_ = thread(&TileCache::run, this);
+}
+
+TileCache::~TileCache() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+}
+
+void TileCache::insert(const TileKey& key, const Tile& tile) {
+  lru_.push_front(key);
+  Entry& e = tiles_[key];
+  e.tile = tile;
+  e.lru = lru_.begin();
+
+  while (tiles_.size() > capacity_) {
+    tiles_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+// Picks the next tile to read, with the lock held: first those get() waits
+// for, then the requested ones. Returns false if there is none.
+bool TileCache::nextKey(TileKey& key) {
+  while (!urgent_.empty()) {
+    key = urgent_.front();
+    urgent_.pop_front();
+    map<TileKey, Entry>::iterator i = tiles_.find(key);
+    if (i != tiles_.end()) {
+      // Read for the queue since get() asked for it
+      if (waiting_.count(key))
+        handoff_[key] = i->second.tile;
+      loaded_.notify_all();
+    }
+    else if (!failed_.count(key))
+      return true;
+  }
+  while (!queue_.empty()) {
+    key = queue_.front();
+    queue_.pop_front();
+    if (!tiles_.count(key) && !failed_.count(key))
+      return true;
+  }
+  return false;
+}
+
+void TileCache::run() {
+  const size_t tilePixels = size_t(image_.tileSize()) * image_.tileSize();
+
+  for (;;) {
+    TileKey key;
+    {
+      unique_lock<mutex> lock(mutex_);
+      while (!stopping_ && !nextKey(key))
+        wake_.wait(lock);
+      if (stopping_)
+        break;
+    }
+
+    shared_ptr<vector<PackedPixel> > tile(new vector<PackedPixel>(tilePixels));
+    try {
+      image_.readTile(key, &(*tile)[0]);
+    }
+    catch (const runtime_error& e) {
+      cerr << "WARN: tile " << key.level << "/" << key.x << "/" << key.y << ": " << e.what() << endl;
+      tile.reset();
+    }
+
+    {
+      lock_guard<mutex> lock(mutex_);
+      ++reads_;
+      // A failed read is remembered apart from the tiles, so that eviction
+      // does not forget it and the tile is not asked for again
+      if (!tile)
+        failed_.insert(key);
+      else {
+        if (!tiles_.count(key))
+          insert(key, tile);
+        if (waiting_.count(key))
+          handoff_[key] = tile;
+      }
+    }
+    loaded_.notify_all();
+  }
+}
+
+void TileCache::request(const vector<TileKey>& keys) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    queue_.clear();
+    for (size_t i = 0; i < keys.size() && queue_.size() < capacity_; ++i) {
+      if (!tiles_.count(keys[i]) && !failed_.count(keys[i]))
+        queue_.push_back(keys[i]);
+    }
+  }
+  wake_.notify_one();
+}
+
+TileCache::Tile TileCache::find(const TileKey& key) {
+  lock_guard<mutex> lock(mutex_);
+  map<TileKey, Entry>::iterator i = tiles_.find(key);
+  if (i == tiles_.end())
+    return Tile();
+  lru_.splice(lru_.begin(), lru_, i->second.lru);
+  return i->second.tile;
+}
+
+TileCache::Tile TileCache::get(const TileKey& key) {
+  unique_lock<mutex> lock(mutex_);
+  map<TileKey, Entry>::iterator i = tiles_.find(key);
+  if (i != tiles_.end()) {
+    lru_.splice(lru_.begin(), lru_, i->second.lru);
+    return i->second.tile;
+  }
+  if (failed_.count(key))
+    return Tile();
+
+  // The reader hands the tile over rather than leaving it to be found among
+  // the others, as reading the queue on may evict it before this thread
+  // wakes up. request() does not clear the urgent keys.
+  ++waiting_[key];
+  urgent_.push_back(key);
+  wake_.notify_one();
+  while (!handoff_.count(key) && !failed_.count(key))
+    loaded_.wait(lock);
+
+  Tile tile;
+  map<TileKey, Tile>::iterator h = handoff_.find(key);
+  if (h != handoff_.end())
+    tile = h->second;
+  if (--waiting_[key] == 0) {
+    waiting_.erase(key);
+    handoff_.erase(key);
+  }
+  return tile;
+}
+
+bool TileCache::failed(const TileKey& key) {
+  lock_guard<mutex> lock(mutex_);
+  return failed_.count(key) != 0;
+}
+
+long TileCache::reads() {
+  lock_guard<mutex> lock(mutex_);
+  return reads_;
+}
@@ -0,0 +1,85 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "tiledimage.h"
+
+// Keeps the most recently used tiles of a tiled image in memory, up to a
+// fixed number of them, and reads the tiles asked for on a background thread
+// so that drawing never waits on the disk.
+class TileCache {
+public:
+  typedef std::shared_ptr<const std::vector<PackedPixel> > Tile;
+
+private:
+  struct Entry {
+    Tile tile;
+    std::list<TileKey>::iterator lru;
+  };
+
+  TiledImage image_;
+  size_t capacity_;
+  std::map<TileKey, Entry> tiles_;
+  std::list<TileKey> lru_;      // most recently used first
+  std::deque<TileKey> queue_;   // tiles to read, in order
+  std::deque<TileKey> urgent_;  // tiles get() waits for, read before the queue
+  std::set<TileKey> failed_;    // tiles that could not be read, never tried again
+  std::map<TileKey, int> waiting_;    // number of get() calls waiting for each tile
+  std::map<TileKey, Tile> handoff_;   // tiles read for them, which eviction does not touch
+  long reads_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable wake_, loaded_;
+  std::thread thread_;
+
+  TileCache(const TileCache&);
+  const TileCache& operator= (const TileCache&);
+
+  void run();
+  bool nextKey(TileKey& key);
+  void insert(const TileKey& key, const Tile& tile);
+
+public:
+  // Opens `filename' (see TiledImage) and starts the reader thread. Holds at
+  // most `capacity' tiles.
+  TileCache(const char *filename, size_t capacity);
+
+  // Stops the reader thread
+  ~TileCache();
+
+  // The image, for its layout; only the reader thread reads tiles from it
+  const TiledImage& image() const {
+    return image_;
+  }
+
+  // Replaces the tiles waiting to be read by `keys', to be read in that order.
+  // Tiles already in memory or that failed to read are skipped, and only the first `capacity' are
+  // taken so that the last of them cannot evict the first.
+  void request(const std::vector<TileKey>& keys);
+
+  // Returns tile `key', marking it most recently used, or an empty pointer if
+  // it is not in memory
+  Tile find(const TileKey& key);
+
+  // Returns tile `key', reading it ahead of the queue and waiting for it if it
+  // is not in memory. Returns an empty pointer if it cannot be read.
+  Tile get(const TileKey& key);
+
+  // True if reading tile `key' failed. Such a tile is never read again, so it
+  // will never be found.
+  bool failed(const TileKey& key);
+
+  // Number of tiles read from disk so far
+  long reads();
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "mipmap.h"
+#include "tiledimage.h"
+
+using namespace std;
+
+static const char MAGIC[8] = { 'P', 'P', 'M', 'T', 'I', 'L', 'E', '1' };
+
+// Header of a tiled image file, followed by the tiles
+struct TiledHeader {
+  char magic[8];
+  int32_t width, height, tileSize, numLevels;
+};
+
+static uint64_t tileBytes(int tileSize) {
+  return uint64_t(tileSize) * tileSize * sizeof(PackedPixel);
+}
+
+// Offsets of the first tile of each level, for an image whose levels are
+// described by `image'
+static void computeLevelOffsets(const TiledImage& image, vector<uint64_t>& offsets) {
+  offsets.resize(image.numLevels());
+  uint64_t offset = sizeof(TiledHeader);
+  for (int l = 0; l < image.numLevels(); ++l) {
+    offsets[l] = offset;
+    offset += uint64_t(image.tilesX(l)) * image.tilesY(l) * tileBytes(image.tileSize());
+  }
+}
+
+TiledImage::TiledImage(const char *filename) {
+  file_.open(filename, ios::binary);
+  if (!file_.is_open())
+    throw runtime_error(string("TiledImage: cannot open ") + filename);
+  file_.exceptions(ios::eofbit | ios::failbit | ios::badbit);
+
+  TiledHeader header;
+  file_.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.width <= 0 || header.height <= 0 ||
+      header.tileSize <= 0 || header.numLevels <= 0)
+    throw runtime_error(string("TiledImage: bad header in ") + filename);
+
+  width_ = header.width;
+  height_ = header.height;
+  tileSize_ = header.tileSize;
+  numLevels_ = header.numLevels;
+  computeLevelOffsets(*this, levelOffsets_);
+}
+
+void TiledImage::readTile(const TileKey& key, PackedPixel *pixels) {
+  if (key.level < 0 || key.level >= numLevels_ || key.x < 0 || key.x >= tilesX(key.level) ||
+      key.y < 0 || key.y >= tilesY(key.level))
+    throw runtime_error("TiledImage: no such tile");
+
+  try {
+    file_.seekg(levelOffsets_[key.level] + (uint64_t(key.y) * tilesX(key.level) + key.x) * tileBytes(tileSize_));
+    file_.read(reinterpret_cast<char*>(pixels), tileBytes(tileSize_));
+  }
+  catch (const ios::failure&) {
+    file_.clear();
+    throw runtime_error("TiledImage: cannot read tile");
+  }
+}
+
+namespace {
+
+// Turns the rows of one level, arriving from the top down, into its tiles and
+// into the rows of the next level
+struct LevelWriter {
+  int width, height, tilesX;
+  uint64_t offset;
+  vector<PackedPixel> band;     // tileSize rows, row y at y % tileSize
+  vector<PackedPixel> pair;     // rows 2k and 2k + 1, to be averaged into row k of the next level
+  vector<PackedPixel> halved;   // row k of the next level
+  vector<PackedPixel> tiles;    // one row of tiles
+};
+
+struct PyramidWriter {
+  ofstream out;
+  int tileSize;
+  vector<LevelWriter> levels;
+};
+
+}
+
+// Writes the row of tiles `ty' of `level' from the band of rows holding it
+static void writeTileRow(PyramidWriter& w, int level, int ty) {
+  LevelWriter& lw = w.levels[level];
+  const int t = w.tileSize;
+  for (int tx = 0; tx < lw.tilesX; ++tx) {
+    PackedPixel *tile = &lw.tiles[size_t(tx) * t * t];
+    const int x0 = tx * t, n = min(t, lw.width - x0);
+    for (int j = 0; j < t; ++j) {
+      const int y = min(ty * t + j, lw.height - 1);
+      const PackedPixel *src = &lw.band[size_t(y % t) * lw.width + x0];
+      PackedPixel *dst = tile + size_t(j) * t;
+      copy(src, src + n, dst);
+      fill(dst + n, dst + t, src[n - 1]);
+    }
+  }
+  w.out.seekp(lw.offset + uint64_t(ty) * lw.tilesX * tileBytes(t));
+  w.out.write(reinterpret_cast<const char*>(&lw.tiles[0]), lw.tilesX * tileBytes(t));
+}
+
+// Adds row y of `level'. Rows must come from the top down.
+static void addRow(PyramidWriter& w, int level, int y, const PackedPixel *row) {
+  LevelWriter& lw = w.levels[level];
+  copy(row, row + lw.width, &lw.band[size_t(y % w.tileSize) * lw.width]);
+  if (y % w.tileSize == 0)
+    writeTileRow(w, level, y / w.tileSize);
+
+  if (level + 1 == int(w.levels.size()))
+    return;
+  // Odd rows wait for the even row below them; the top row of an odd height
+  // is averaged on its own
+  if (y % 2 == 1) {
+    copy(row, row + lw.width, &lw.pair[lw.width]);
+    return;
+  }
+  copy(row, row + lw.width, &lw.pair[0]);
+  downsampleImage(&lw.pair[0], lw.width, y + 1 < lw.height ? 2 : 1, true, &lw.halved[0]);
+  addRow(w, level + 1, y / 2, &lw.halved[0]);
+}
+
+void convertToTiledImage(const char *ppmFilename, const char *tiledFilename, int tileSize) {
+  ifstream in;
+  int width, height;
+  ppmOpen(ppmFilename, in, width, height);
+
+  TiledHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.width = width;
+  header.height = height;
+  header.tileSize = tileSize;
+  header.numLevels = 1;
+  for (int w = width, h = height; w > tileSize || h > tileSize; w = (w + 1) / 2, h = (h + 1) / 2)
+    ++header.numLevels;
+
+  PyramidWriter w;
+  w.tileSize = tileSize;
+  w.levels.resize(header.numLevels);
+  uint64_t offset = sizeof(TiledHeader);
+  for (int l = 0; l < header.numLevels; ++l) {
+    LevelWriter& lw = w.levels[l];
+    lw.width = ((width - 1) >> l) + 1;
+    lw.height = ((height - 1) >> l) + 1;
+    lw.tilesX = (lw.width + tileSize - 1) / tileSize;
+    lw.offset = offset;
+    lw.band.resize(size_t(tileSize) * lw.width);
+    lw.pair.resize(2 * size_t(lw.width));
+    lw.halved.resize((lw.width + 1) / 2);
+    lw.tiles.resize(size_t(lw.tilesX) * tileSize * tileSize);
+    offset += uint64_t(lw.tilesX) * ((lw.height + tileSize - 1) / tileSize) * tileBytes(tileSize);
+  }
+
+  const string tmp = string(tiledFilename) + ".tmp";
+  w.out.open(tmp.c_str(), ios::binary);
+  if (!w.out.is_open())
+    throw runtime_error("convertToTiledImage: cannot create " + tmp);
+  try {
+    w.out.exceptions(ios::failbit | ios::badbit);
+    w.out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    vector<PackedPixel> row(width);
+    for (int y = height - 1; y >= 0; --y) {
+      in.read(reinterpret_cast<char*>(&row[0]), width * sizeof(PackedPixel));
+      addRow(w, 0, y, &row[0]);
+    }
+    w.out.close();
+  }
+  catch (const ios::failure&) {
+    w.out.exceptions(ios::goodbit);
+    w.out.close();
+    remove(tmp.c_str());
+    throw runtime_error(string("convertToTiledImage: cannot convert ") + ppmFilename);
+  }
+
+  remove(tiledFilename);
+  if (rename(tmp.c_str(), tiledFilename) != 0) {
+    remove(tmp.c_str());
+    throw runtime_error(string("convertToTiledImage: cannot create ") + tiledFilename);
+  }
+}
+
+bool tiledImageUpToDate(const char *ppmFilename, const char *tiledFilename) {
+  struct stat ppm, tiled;
+  return stat(ppmFilename, &ppm) == 0 && stat(tiledFilename, &tiled) == 0 && tiled.st_mtime >= ppm.st_mtime;
+}
@@ -0,0 +1,86 @@
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <fstream>
+#include <vector>
+#include <stdint.h>
+
+#include "ppm.h"
+
+// One tile of a tiled image: column x and row y (from the bottom) of a level
+struct TileKey {
+  int level, x, y;
+
+  bool operator< (const TileKey& k) const {
+    if (level != k.level)
+      return level < k.level;
+    return y != k.y ? y < k.y : x < k.x;
+  }
+
+  bool operator== (const TileKey& k) const {
+    return level == k.level && x == k.x && y == k.y;
+  }
+};
+
+// An image stored as a pyramid of square tiles, for images too large to read
+// whole or to fit in one texture. Level 0 is the image itself; each further
+// level halves the previous one, rounding up, until it fits in one tile. Tiles
+// are tileSize x tileSize pixels stored bottom row first, like the images
+// ppmRead returns, and those on the right and top edges of a level are padded
+// by repeating its last column and row. The file is a header followed by the
+// tiles of every level, row by row from the bottom, so any tile is read with a
+// single seek.
+class TiledImage {
+  std::ifstream file_;
+  int width_, height_, tileSize_, numLevels_;
+  std::vector<uint64_t> levelOffsets_;
+
+  TiledImage(const TiledImage&);
+  const TiledImage& operator= (const TiledImage&);
+
+public:
+  // Opens a file written by convertToTiledImage(). Throws runtime_error on
+  // error.
+  explicit TiledImage(const char *filename);
+
+  int numLevels() const {
+    return numLevels_;
+  }
+
+  int tileSize() const {
+    return tileSize_;
+  }
+
+  // Size of `level' in pixels
+  int width(int level) const {
+    return ((width_ - 1) >> level) + 1;
+  }
+
+  int height(int level) const {
+    return ((height_ - 1) >> level) + 1;
+  }
+
+  // Number of tiles across and up `level'
+  int tilesX(int level) const {
+    return (width(level) + tileSize_ - 1) / tileSize_;
+  }
+
+  int tilesY(int level) const {
+    return (height(level) + tileSize_ - 1) / tileSize_;
+  }
+
+  // Reads tile `key' into `pixels', which holds tileSize() * tileSize()
+  // pixels. Not thread safe. Throws runtime_error on error.
+  void readTile(const TileKey& key, PackedPixel *pixels);
+};
+
+// Converts binary PPM `ppmFilename' into a tiled image file. The image is
+// streamed through: only one band of tileSize rows of each level is held in
+// memory. Levels are averaged in linear light. The file is written under a
+// temporary name and renamed when complete. Throws runtime_error on error.
+void convertToTiledImage(const char *ppmFilename, const char *tiledFilename, int tileSize);
+
+// Whether `tiledFilename' exists and is not older than `ppmFilename'
+bool tiledImageUpToDate(const char *ppmFilename, const char *tiledFilename);
+
+#endif
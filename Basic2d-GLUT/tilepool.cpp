@@ -0,0 +1,50 @@
+#include "tilepool.h"
+
+using namespace std;
+
+TilePool::TilePool(int tileSize, int numSlots, GLenum internalFormat)
+  : texture_(GL_TEXTURE_2D_ARRAY), tileSize_(tileSize), frame_(1), uploads_(0) {
+  Slot empty = { TileKey(), 0, false, false };
+  slots_.assign(numSlots, empty);
+
+  texture_.storage3D(1, internalFormat, tileSize, tileSize, numSlots);
+  texture_.parameteri(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  texture_.parameteri(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  texture_.parameteri(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  texture_.parameteri(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  checkGlErrors();
+}
+
+int TilePool::find(const TileKey& key) const {
+  map<TileKey, int>::const_iterator i = layerOf_.find(key);
+  return i == layerOf_.end() ? -1 : i->second;
+}
+
+int TilePool::add(const TileKey& key, const PackedPixel *pixels, bool pinned) {
+  // A free layer if there is one, otherwise the least recently drawn one
+  int layer = -1;
+  for (int s = 0; s < int(slots_.size()); ++s) {
+    const Slot& slot = slots_[s];
+    if (slot.pinned || slot.lastFrame == frame_)
+      continue;
+    if (layer < 0 || !slot.used || slot.lastFrame < slots_[layer].lastFrame)
+      layer = s;
+    if (!slot.used)
+      break;
+  }
+  if (layer < 0)
+    return -1;
+
+  Slot& slot = slots_[layer];
+  if (slot.used)
+    layerOf_.erase(slot.key);
+  slot.key = key;
+  slot.lastFrame = frame_;
+  slot.used = true;
+  slot.pinned = pinned;
+  layerOf_[key] = layer;
+
+  texture_.subImage3D(0, 0, 0, layer, tileSize_, tileSize_, 1, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+  ++uploads_;
+  return layer;
+}
@@ -0,0 +1,69 @@
+#ifndef TILEPOOL_H
+#define TILEPOOL_H
+
+#include <map>
+#include <vector>
+
+#include "glsupport.h"
+#include "ppm.h"
+#include "tiledimage.h"
+
+// A fixed number of tiles resident on the GPU, one per layer of an array
+// texture, so that any set of them is drawn with a single bind. When the pool
+// is full, a new tile takes the layer of the least recently drawn tile, never
+// that of a tile drawn in the current frame or of a pinned tile.
+class TilePool : Noncopyable {
+  struct Slot {
+    TileKey key;
+    unsigned lastFrame;
+    bool used, pinned;
+  };
+
+  GlTexture texture_;
+  int tileSize_;
+  std::vector<Slot> slots_;
+  std::map<TileKey, int> layerOf_;
+  unsigned frame_;
+  long uploads_;
+
+public:
+  // Allocates `numSlots' layers of tileSize x tileSize texels of
+  // `internalFormat', filtered linearly
+  TilePool(int tileSize, int numSlots, GLenum internalFormat);
+
+  // Starts a new frame: tiles drawn by earlier frames may give up their layer
+  void beginFrame() {
+    ++frame_;
+  }
+
+  // Layer holding tile `key', or -1 if it is not resident. Does not count as
+  // a use.
+  int find(const TileKey& key) const;
+
+  // Marks the tile in `layer' as drawn by the current frame
+  void use(int layer) {
+    slots_[layer].lastFrame = frame_;
+  }
+
+  // Uploads tile `key' into a free or reusable layer, marks it used and
+  // returns the layer, or -1 if every layer is taken by the current frame.
+  // Tile rows are read tightly packed, so GL_UNPACK_ALIGNMENT must be 1.
+  // Without direct state access, the texture is left bound on the active
+  // unit.
+  int add(const TileKey& key, const PackedPixel *pixels, bool pinned = false);
+
+  GLuint texture() const {
+    return texture_;
+  }
+
+  int numSlots() const {
+    return int(slots_.size());
+  }
+
+  // Number of tiles uploaded so far
+  long uploads() const {
+    return uploads_;
+  }
+};
+
+#endif
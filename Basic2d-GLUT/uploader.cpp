@@ -0,0 +1,215 @@
+#include <stdexcept>
+#include <string>
+
+#include "uploader.h"
+
+#if defined(_WIN32)
+# include <windows.h>
+#elif !defined(__MAC__)
+# include <GL/glx.h>
+# include <X11/Xlib.h>
+#endif
+
+using namespace std;
+
+// Window-system handles of the uploader's context
+#if defined(_WIN32)
+
+struct UploaderContext {
+  HDC dc;
+  HGLRC context;
+};
+
+static UploaderContext *createSharedContext() {
+  UploaderContext *c = new UploaderContext();
+  c->dc = wglGetCurrentDC();
+  c->context = wglCreateContext(c->dc);
+  if (!c->context || !wglShareLists(wglGetCurrentContext(), c->context)) {
+    if (c->context)
+      wglDeleteContext(c->context);
+    delete c;
+    throw runtime_error("TextureUploader: cannot create a shared WGL context");
+  }
+  return c;
+}
+
+static void makeCurrent(UploaderContext *c) {
+  wglMakeCurrent(c->dc, c->context);
+}
+
+static void releaseCurrent(UploaderContext *) {
+  wglMakeCurrent(NULL, NULL);
+}
+
+static void destroySharedContext(UploaderContext *c) {
+  wglDeleteContext(c->context);
+  delete c;
+}
+
+#elif !defined(__MAC__)
+
+struct UploaderContext {
+  Display *display;
+  GLXPbuffer pbuffer;
+  GLXContext context;
+};
+
+static UploaderContext *createSharedContext() {
+  Display *dpy = glXGetCurrentDisplay();
+  GLXContext share = glXGetCurrentContext();
+  if (!dpy || !share)
+    throw runtime_error("TextureUploader: no current GLX context");
+
+  // Same framebuffer configuration as the window's context, with a 1x1
+  // pbuffer to make the new context current on
+  int fbConfigId = 0, screen = 0;
+  glXQueryContext(dpy, share, GLX_FBCONFIG_ID, &fbConfigId);
+  glXQueryContext(dpy, share, GLX_SCREEN, &screen);
+  const int configAttribs[] = { GLX_FBCONFIG_ID, fbConfigId, None };
+  int numConfigs = 0;
+  GLXFBConfig *configs = glXChooseFBConfig(dpy, screen, configAttribs, &numConfigs);
+  if (!configs || numConfigs == 0)
+    throw runtime_error("TextureUploader: cannot find the window's GLX framebuffer config");
+
+  const int pbufferAttribs[] = { GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None };
+  UploaderContext *c = new UploaderContext();
+  c->display = dpy;
+  c->pbuffer = glXCreatePbuffer(dpy, configs[0], pbufferAttribs);
+  c->context = glXCreateNewContext(dpy, configs[0], GLX_RGBA_TYPE, share, True);
+  XFree(configs);
+  if (!c->pbuffer || !c->context) {
+    if (c->context)
+      glXDestroyContext(dpy, c->context);
+    if (c->pbuffer)
+      glXDestroyPbuffer(dpy, c->pbuffer);
+    delete c;
+    throw runtime_error("TextureUploader: cannot create a shared GLX context");
+  }
+  return c;
+}
+
+static void makeCurrent(UploaderContext *c) {
+  glXMakeContextCurrent(c->display, c->pbuffer, c->pbuffer, c->context);
+}
+
+static void releaseCurrent(UploaderContext *c) {
+  glXMakeContextCurrent(c->display, None, None, NULL);
+}
+
+static void destroySharedContext(UploaderContext *c) {
+  glXDestroyContext(c->display, c->context);
+  glXDestroyPbuffer(c->display, c->pbuffer);
+  delete c;
+}
+
+#else
+
+struct UploaderContext {};
+
+static UploaderContext *createSharedContext() {
+  throw runtime_error("TextureUploader: shared contexts are not supported with GLUT on the Mac");
+}
+
+static void makeCurrent(UploaderContext *) {}
+static void releaseCurrent(UploaderContext *) {}
+static void destroySharedContext(UploaderContext *c) { delete c; }
+
+#endif
+
+bool TextureUploader::supported() {
+#ifdef __MAC__
+  return false;
+#else
+  return GLEW_VERSION_3_2 || GLEW_ARB_sync;
+#endif
+}
+
+void TextureUploader::initThreading() {
+#if !defined(_WIN32) && !defined(__MAC__)
+  XInitThreads();
+#endif
+}
+
+TextureUploader::TextureUploader()
+  : context_(createSharedContext()), nextTicket_(0), stopping_(false) {
+  thread_ = thread(&TextureUploader::run, this);
+}
+
+TextureUploader::~TextureUploader() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+
+  for (map<int, Result>::iterator i = done_.begin(); i != done_.end(); ++i) {
+    if (i->second.fence)
+      glDeleteSync(i->second.fence);
+  }
+  destroySharedContext(context_);
+}
+
+void TextureUploader::run() {
+  makeCurrent(context_);
+
+  for (;;) {
+    pair<int, function<void()> > job;
+    {
+      unique_lock<mutex> lock(mutex_);
+      while (jobs_.empty() && !stopping_)
+        wake_.wait(lock);
+      if (jobs_.empty())
+        break;
+      job = jobs_.front();
+      jobs_.pop_front();
+    }
+
+    Result r;
+    try {
+      job.second();
+    }
+    catch (const exception& e) {
+      r.error = e.what();
+    }
+    // Flush so that the fence reaches the GPU and the render thread can wait on it
+    r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    lock_guard<mutex> lock(mutex_);
+    done_[job.first] = r;
+  }
+
+  releaseCurrent(context_);
+}
+
+int TextureUploader::submit(const function<void()>& job) {
+  int ticket;
+  {
+    lock_guard<mutex> lock(mutex_);
+    ticket = nextTicket_++;
+    jobs_.push_back(make_pair(ticket, job));
+  }
+  wake_.notify_one();
+  return ticket;
+}
+
+bool TextureUploader::acquire(int ticket) {
+  Result r;
+  {
+    lock_guard<mutex> lock(mutex_);
+    map<int, Result>::iterator i = done_.find(ticket);
+    if (i == done_.end())
+      return false;
+    r = i->second;
+    i->second.fence = 0;
+  }
+
+  if (r.fence) {
+    glWaitSync(r.fence, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(r.fence);
+  }
+  if (!r.error.empty())
+    throw runtime_error(r.error);
+  return true;
+}
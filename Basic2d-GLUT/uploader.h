@@ -0,0 +1,64 @@
+#ifndef UPLOADER_H
+#define UPLOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "glsupport.h"
+
+struct UploaderContext;
+
+// Background thread with its own GL context, sharing objects with the context
+// that was current when it was created. Jobs submitted to it run on that
+// thread (typically creating and filling textures); after each job the thread
+// inserts a fence and publishes it. The render thread acquires a job's
+// results before first use, which makes the GPU wait on the fence instead of
+// the render thread doing the upload itself.
+class TextureUploader : Noncopyable {
+  struct Result {
+    GLsync fence;
+    std::string error;
+  };
+
+  UploaderContext *context_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::pair<int, std::function<void()> > > jobs_;
+  std::map<int, Result> done_;
+  int nextTicket_;
+  bool stopping_;
+
+  void run();
+
+public:
+  // Creates the shared context and starts the thread. Throws runtime_error if
+  // no shared context can be created.
+  TextureUploader();
+
+  // Finishes the queued jobs, then stops the thread
+  ~TextureUploader();
+
+  // True if shared contexts can be created on this platform
+  static bool supported();
+
+  // Must be called before GLUT opens its display, so that the window system
+  // connection may be used from the uploader thread too
+  static void initThreading();
+
+  // Queues `job' to run on the uploader thread. Returns a ticket for acquire().
+  int submit(const std::function<void()>& job);
+
+  // Called on the render thread. Returns false while the job is still
+  // running. The call that first returns true makes the render thread's GL
+  // command stream wait for the job's uploads. Throws runtime_error if the job
+  // threw.
+  bool acquire(int ticket);
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "pixelconvert.h"
+#include "uploadring.h"
+
+using namespace std;
+
+// Ring offsets are kept aligned to this many bytes
+static const size_t UPLOAD_RING_ALIGNMENT = 64;
+
+static const GLbitfield PERSISTENT_MAP_FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+bool UploadRing::supported() {
+  return GLEW_VERSION_3_2 || GLEW_ARB_sync;
+}
+
+UploadRing::UploadRing(size_t size)
+  : size_(size), head_(0), mapped_(NULL), stalls_(0), bytesUploaded_(0) {
+  if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+    pbo_.storage(size_, NULL, PERSISTENT_MAP_FLAGS);
+    mapped_ = static_cast<unsigned char*>(pbo_.mapRange(0, size_, PERSISTENT_MAP_FLAGS));
+    if (!mapped_)
+      throw runtime_error("UploadRing: cannot map the staging buffer");
+  }
+  else {
+    pbo_.data(size_, NULL, GL_STREAM_DRAW);
+  }
+  checkGlErrors();
+}
+
+UploadRing::~UploadRing() {
+  while (!inFlight_.empty()) {
+    glDeleteSync(inFlight_.front().fence);
+    inFlight_.pop_front();
+  }
+  if (mapped_)
+    pbo_.unmap();
+}
+
+// Waits for the oldest region in flight to be consumed and releases it
+void UploadRing::retireOldest() {
+  Region& r = inFlight_.front();
+  if (glClientWaitSync(r.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+    ++stalls_;
+    while (glClientWaitSync(r.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+      ;
+  }
+  glDeleteSync(r.fence);
+  inFlight_.pop_front();
+}
+
+// Returns the offset of `bytes' free bytes, waiting for the regions in flight
+// that overlap them. Regions are handed out in order, so the ones in the way
+// are always the oldest.
+size_t UploadRing::allocate(size_t bytes) {
+  size_t offset = head_;
+  if (offset + bytes > size_)
+    offset = 0;
+
+  while (!inFlight_.empty()) {
+    const Region& r = inFlight_.front();
+    const bool overlaps = r.offset < offset + bytes && offset < r.offset + r.size;
+    // When wrapping around, everything between the old head and the end of
+    // the ring is also being skipped over
+    const bool skipped = offset < head_ && r.offset >= head_;
+    if (!overlaps && !skipped)
+      break;
+    retireOldest();
+  }
+
+  head_ = offset + ((bytes + UPLOAD_RING_ALIGNMENT - 1) & ~(UPLOAD_RING_ALIGNMENT - 1));
+  return offset;
+}
+
+void UploadRing::upload(const GlTexture& texture, bool layered, GLint level, GLint x, GLint y, GLint layer,
+                        GLsizei width, GLsizei height, GLenum format, GLenum type,
+                        int bytesPerPixel, const void *pixels, bool expandRgb) {
+  if (width <= 0 || height <= 0)
+    throw runtime_error("UploadRing: the upload is empty");
+  const size_t rowBytes = size_t(width) * bytesPerPixel;
+  if (rowBytes > size_)
+    throw runtime_error("UploadRing: a single row does not fit in the ring");
+  const size_t srcRowBytes = expandRgb ? size_t(width) * sizeof(PackedPixel) : rowBytes;
+  const GLsizei bandRows = max(GLsizei(1), GLsizei(size_ / 2 / rowBytes));
+
+  // The texture is filled from the buffer bound here, with or without direct
+  // state access
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+  for (GLsizei row = 0; row < height; row += bandRows) {
+    const GLsizei rows = min(bandRows, height - row);
+    const size_t bytes = rows * rowBytes;
+    const size_t offset = allocate(bytes);
+    const unsigned char *src = static_cast<const unsigned char*>(pixels) + row * srcRowBytes;
+
+    unsigned char *dst = mapped_ + offset;
+    if (!mapped_) {
+      dst = static_cast<unsigned char*>(pbo_.mapRange(offset, bytes,
+          GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+      if (!dst)
+        throw runtime_error("UploadRing: cannot map a staging region");
+    }
+    if (expandRgb)
+      expandRgbToBgra(reinterpret_cast<const PackedPixel*>(src), dst, size_t(rows) * width);
+    else
+      memcpy(dst, src, bytes);
+    if (!mapped_)
+      pbo_.unmap();
+
+    const GLvoid *bufferOffset = reinterpret_cast<const GLvoid*>(offset);
+    if (layered)
+      texture.subImage3D(level, x, y + row, layer, width, rows, 1, format, type, bufferOffset);
+    else
+      texture.subImage2D(level, x, y + row, width, rows, format, type, bufferOffset);
+
+    Region r = { offset, bytes, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) };
+    inFlight_.push_back(r);
+    bytesUploaded_ += bytes;
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  checkGlErrors();
+}
+
+void UploadRing::texSubImage2D(const GlTexture& texture, GLint level, GLint x, GLint y, GLsizei width,
+                               GLsizei height, GLenum format, GLenum type, int bytesPerPixel, const void *pixels) {
+  upload(texture, false, level, x, y, 0, width, height, format, type, bytesPerPixel, pixels, false);
+}
+
+void UploadRing::texSubImage2DExpanded(const GlTexture& texture, GLint level, GLint x, GLint y, GLsizei width,
+                                       GLsizei height, const PackedPixel *pixels) {
+  upload(texture, false, level, x, y, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 4, pixels, true);
+}
+
+void UploadRing::texSubImage3D(const GlTexture& texture, GLint level, GLint x, GLint y, GLint layer,
+                               GLsizei width, GLsizei height, GLenum format, GLenum type, int bytesPerPixel,
+                               const void *pixels) {
+  upload(texture, true, level, x, y, layer, width, height, format, type, bytesPerPixel, pixels, false);
+}
@@ -0,0 +1,72 @@
+#ifndef UPLOADRING_H
+#define UPLOADRING_H
+
+#include <deque>
+#include <stdint.h>
+
+#include "glsupport.h"
+#include "ppm.h"
+
+// Streams texture uploads through a ring of GL_PIXEL_UNPACK_BUFFER memory.
+// Pixels are copied into the ring and the texture is filled from a buffer
+// offset, so the GL call returns without the driver copying synchronously.
+// Each region of the ring is protected by a fence and reused once the GPU has
+// consumed it. With GL 4.4 / ARB_buffer_storage the buffer stays mapped for
+// its whole life (persistent, coherent); otherwise each region is mapped
+// unsynchronized on its own, as the fences already guarantee it is free.
+class UploadRing : Noncopyable {
+  struct Region {
+    size_t offset, size;
+    GLsync fence;
+  };
+
+  GlBufferObject pbo_;
+  size_t size_, head_;
+  unsigned char *mapped_;
+  std::deque<Region> inFlight_;
+  long stalls_;
+  uint64_t bytesUploaded_;
+
+  size_t allocate(size_t bytes);
+  void retireOldest();
+  void upload(const GlTexture& texture, bool layered, GLint level, GLint x, GLint y, GLint layer,
+              GLsizei width, GLsizei height, GLenum format, GLenum type,
+              int bytesPerPixel, const void *pixels, bool expandRgb);
+
+public:
+  explicit UploadRing(size_t size);
+  ~UploadRing();
+
+  // True if the context has what the ring needs (fence sync objects)
+  static bool supported();
+
+  bool persistent() const {
+    return mapped_ != NULL;
+  }
+
+  // Same as texture.subImage2D() with tightly packed client memory. Uploads
+  // larger than half the ring are split into bands of rows. Throws
+  // runtime_error if the region is empty or a row is larger than the ring.
+  void texSubImage2D(const GlTexture& texture, GLint level, GLint x, GLint y, GLsizei width,
+                     GLsizei height, GLenum format, GLenum type, int bytesPerPixel, const void *pixels);
+
+  // Uploads RGB pixels as GL_BGRA / GL_UNSIGNED_INT_8_8_8_8_REV, expanding
+  // them to four bytes each while they are copied into the ring
+  void texSubImage2DExpanded(const GlTexture& texture, GLint level, GLint x, GLint y, GLsizei width,
+                             GLsizei height, const PackedPixel *pixels);
+
+  // Same as texSubImage2D for one layer of an array texture
+  void texSubImage3D(const GlTexture& texture, GLint level, GLint x, GLint y, GLint layer, GLsizei width,
+                     GLsizei height, GLenum format, GLenum type, int bytesPerPixel, const void *pixels);
+
+  // Number of times an upload had to wait for the GPU to release ring memory
+  long stalls() const {
+    return stalls_;
+  }
+
+  uint64_t bytesUploaded() const {
+    return bytesUploaded_;
+  }
+};
+
+#endif
@@ -0,0 +1,18 @@
+#include "vertexformat.h"
+
+void setVertexAttributes(const VertexFormat& format, GLuint vbo, GLuint divisor, size_t baseOffset) {
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  for (int i = 0; i < format.numAttributes; ++i) {
+    const VertexAttribute& a = format.attributes[i];
+    glVertexAttribPointer(a.location, a.size, a.type, a.normalized, format.stride,
+                          reinterpret_cast<const GLvoid*>(baseOffset + a.offset));
+    glEnableVertexAttribArray(a.location);
+    if (divisor)
+      glVertexAttribDivisor(a.location, divisor);
+  }
+}
+
+void disableVertexAttributes(const VertexFormat& format) {
+  for (int i = 0; i < format.numAttributes; ++i)
+    glDisableVertexAttribArray(format.attributes[i].location);
+}
@@ -0,0 +1,70 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <cstddef>
+
+#include "glsupport.h"
+
+// One attribute of an interleaved vertex: `size' components of `type',
+// `offset' bytes into the vertex, fed to attribute `location'
+struct VertexAttribute {
+  GLuint location;
+  GLint size;
+  GLenum type;
+  GLboolean normalized;
+  size_t offset;
+};
+
+// Layout of the vertices of an interleaved vertex buffer
+struct VertexFormat {
+  GLsizei stride;
+  int numAttributes;
+  const VertexAttribute *attributes;
+};
+
+// GL type of a component type
+template <typename T> struct GlComponentType;
+template <> struct GlComponentType<GLfloat> { static const GLenum value = GL_FLOAT; };
+template <> struct GlComponentType<GLbyte> { static const GLenum value = GL_BYTE; };
+template <> struct GlComponentType<GLubyte> { static const GLenum value = GL_UNSIGNED_BYTE; };
+template <> struct GlComponentType<GLshort> { static const GLenum value = GL_SHORT; };
+template <> struct GlComponentType<GLushort> { static const GLenum value = GL_UNSIGNED_SHORT; };
+template <> struct GlComponentType<GLint> { static const GLenum value = GL_INT; };
+template <> struct GlComponentType<GLuint> { static const GLenum value = GL_UNSIGNED_INT; };
+
+// Number and GL type of the components of a vertex member: a single
+// component, or an array of them
+template <typename T> struct AttributeTraits {
+  static const GLint size = 1;
+  static const GLenum type = GlComponentType<T>::value;
+};
+
+template <typename T, size_t N> struct AttributeTraits<T[N]> {
+  static const GLint size = GLint(N);
+  static const GLenum type = GlComponentType<T>::value;
+};
+
+// Describes member `member' of vertex struct `Vertex' as the attribute fed
+// to `location'. The size, type and offset come from the struct, so they
+// cannot get out of step with it.
+#define VERTEX_ATTRIBUTE(Vertex, member, location, normalized) \
+  { (location), AttributeTraits<decltype(Vertex::member)>::size, \
+    AttributeTraits<decltype(Vertex::member)>::type, (normalized), offsetof(Vertex, member) }
+
+// The format of vertex struct `Vertex', made of `attributes'
+template <typename Vertex, int N>
+VertexFormat vertexFormat(const VertexAttribute (&attributes)[N]) {
+  VertexFormat format = { GLsizei(sizeof(Vertex)), N, attributes };
+  return format;
+}
+
+// Points the attributes of `format' at vertex buffer `vbo', the first vertex
+// being `baseOffset' bytes into it, and enables them. With a nonzero
+// `divisor', the attributes advance once every `divisor' instances rather
+// than once per vertex, which needs GL 3.3.
+void setVertexAttributes(const VertexFormat& format, GLuint vbo, GLuint divisor = 0, size_t baseOffset = 0);
+
+// Disables the attributes of `format'
+void disableVertexAttributes(const VertexFormat& format);
+
+#endif
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define VERTEXPACK_SSE2 1
+# include <emmintrin.h>
+#endif
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+# define VERTEXPACK_F16C 1
+# include <immintrin.h>
+#endif
+
+#include "vertexpack.h"
+
+using namespace std;
+
+static GLushort floatToHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000;
+  const int exponent = int((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = x & 0x7fffff;
+
+  if (((x >> 23) & 0xff) == 0xff)
+    return GLushort(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+  if (exponent >= 31)
+    return GLushort(sign | 0x7c00);
+  if (exponent <= 0) {
+    // Subnormal, or too small even for that
+    if (exponent < -10)
+      return GLushort(sign);
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    uint32_t h = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (h & 1)))
+      ++h;
+    return GLushort(sign | h);
+  }
+
+  // Rounding up may carry into the exponent, which is still right
+  uint32_t h = (uint32_t(exponent) << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+    ++h;
+  return GLushort(sign | h);
+}
+
+void packHalf(const float *src, Half *dst, size_t count) {
+  size_t i = 0;
+#ifdef VERTEXPACK_F16C
+  for (; i + 4 <= count; i += 4) {
+    const __m128i h = _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), h);
+  }
+#endif
+  for (; i < count; ++i)
+    dst[i].bits = floatToHalf(src[i]);
+}
+
+void packSnorm16(const float *src, float center, float extent, GLshort *dst, size_t count) {
+  const float scale = 32767.f / extent;
+  size_t i = 0;
+#ifdef VERTEXPACK_SSE2
+  // Eight at a time: convert with the default round to nearest even, and let
+  // the pack saturate
+  const __m128 c = _mm_set1_ps(center), s = _mm_set1_ps(scale);
+  for (; i + 8 <= count; i += 8) {
+    const __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + i), c), s));
+    const __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + i + 4), c), s));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(lo, hi));
+  }
+#endif
+  for (; i < count; ++i)
+    dst[i] = GLshort(max(-32768L, min(32767L, lrint((src[i] - center) * scale))));
+}
+
+void packUnorm8(const float *src, GLubyte *dst, size_t count) {
+  size_t i = 0;
+#ifdef VERTEXPACK_SSE2
+  const __m128 s = _mm_set1_ps(255.f);
+  for (; i + 16 <= count; i += 16) {
+    const __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i), s));
+    const __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 4), s));
+    const __m128i c = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 8), s));
+    const __m128i d = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src + i + 12), s));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+  }
+#endif
+  for (; i < count; ++i)
+    dst[i] = GLubyte(max(0L, min(255L, lrint(src[i] * 255.f))));
+}
+
+void packIndices16(const GLuint *src, GLushort *dst, size_t count) {
+  size_t i = 0;
+#ifdef VERTEXPACK_SSE2
+  // SSE2 only packs with signed saturation: shift the indices into the
+  // signed range and back
+  const __m128i bias32 = _mm_set1_epi32(32768), bias16 = _mm_set1_epi16(short(0x8000));
+  for (; i + 8 <= count; i += 8) {
+    const __m128i lo = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), bias32);
+    const __m128i hi = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4)), bias32);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(_mm_packs_epi32(lo, hi), bias16));
+  }
+#endif
+  for (; i < count; ++i)
+    dst[i] = GLushort(src[i]);
+}
+
+static size_t componentBytes(GLenum type) {
+  switch (type) {
+  case GL_HALF_FLOAT:
+  case GL_SHORT:
+    return 2;
+  case GL_UNSIGNED_BYTE:
+    return 1;
+  default:
+    return 4;
+  }
+}
+
+void packVertices(const VertexFormat& srcFormat, const void *src, const VertexFormat& dstFormat, void *dst,
+                  size_t count, AttributeDecode *decodes) {
+  if (count == 0)
+    return;
+  const unsigned char *in = static_cast<const unsigned char*>(src);
+  unsigned char *out = static_cast<unsigned char*>(dst);
+
+  // One component of one attribute at a time, gathered into a contiguous
+  // array so that it converts with SIMD, then scattered into the vertices
+  vector<float> values(count);
+  vector<unsigned char> packed(count * 4);
+  for (int a = 0; a < dstFormat.numAttributes; ++a) {
+    const VertexAttribute& from = srcFormat.attributes[a];
+    const VertexAttribute& to = dstFormat.attributes[a];
+    const size_t bytes = componentBytes(to.type);
+    AttributeDecode& decode = decodes[a];
+
+    for (int c = 0; c < to.size; ++c) {
+      decode.offset[c] = 0;
+      decode.scale[c] = 1;
+      if (c < from.size) {
+        for (size_t i = 0; i < count; ++i)
+          memcpy(&values[i], in + i * srcFormat.stride + from.offset + c * sizeof(float), sizeof(float));
+      }
+      else
+        fill(values.begin(), values.end(), c == 3 ? 1.f : 0.f);
+
+      switch (to.type) {
+      case GL_HALF_FLOAT:
+        packHalf(&values[0], reinterpret_cast<Half*>(&packed[0]), count);
+        break;
+      case GL_SHORT: {
+        float lo = count ? values[0] : 0, hi = lo;
+        for (size_t i = 0; i < count; ++i) {
+          lo = min(lo, values[i]);
+          hi = max(hi, values[i]);
+        }
+        decode.offset[c] = (lo + hi) / 2;
+        decode.scale[c] = hi > lo ? (hi - lo) / 2 : 1;
+        packSnorm16(&values[0], decode.offset[c], decode.scale[c], reinterpret_cast<GLshort*>(&packed[0]), count);
+        break;
+      }
+      case GL_UNSIGNED_BYTE:
+        packUnorm8(&values[0], &packed[0], count);
+        break;
+      default:
+        memcpy(&packed[0], &values[0], count * sizeof(float));
+        break;
+      }
+
+      for (size_t i = 0; i < count; ++i)
+        memcpy(out + i * dstFormat.stride + to.offset + c * bytes, &packed[i * bytes], bytes);
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef VERTEXPACK_H
+#define VERTEXPACK_H
+
+#include <cstddef>
+
+#include "vertexformat.h"
+
+// A half precision float, as stored in vertex buffers
+struct Half {
+  GLushort bits;
+};
+
+template <> struct GlComponentType<Half> { static const GLenum value = GL_HALF_FLOAT; };
+
+// Converts floats to half floats, rounding to nearest even. Uses F16C where
+// available.
+void packHalf(const float *src, Half *dst, size_t count);
+
+// Maps floats in [center - extent, center + extent] to normalized shorts, so
+// that a GL_SHORT attribute read as normalized gives back (x - center) /
+// extent. Uses SSE2 where available, as do the conversions below.
+void packSnorm16(const float *src, float center, float extent, GLshort *dst, size_t count);
+
+// Converts floats in [0, 1] to normalized unsigned bytes, clamping the rest
+void packUnorm8(const float *src, GLubyte *dst, size_t count);
+
+// Narrows indices, which must all be below 65536, to 16 bits
+void packIndices16(const GLuint *src, GLushort *dst, size_t count);
+
+// How to get an attribute's values back from what a compact format stores:
+// each component is offset + stored * scale
+struct AttributeDecode {
+  float offset[4], scale[4];
+};
+
+// Converts `count' vertices from `srcFormat', whose attributes are all
+// GL_FLOAT, to `dstFormat', which has the same attributes in the same order
+// with GL_FLOAT, GL_HALF_FLOAT, normalized GL_SHORT or normalized
+// GL_UNSIGNED_BYTE components. Normalized shorts are fitted to the bounding
+// box of their component; `decodes' receives, for each attribute, how to undo
+// that. Components missing from the source are filled with 1 for a fourth
+// (alpha) component and 0 otherwise.
+void packVertices(const VertexFormat& srcFormat, const void *src, const VertexFormat& dstFormat, void *dst,
+                  size_t count, AttributeDecode *decodes);
+
+#endif